@@ -1,6 +1,6 @@
 /**
  * Basic Environment for Game 2048
- * use 'g++ -std=c++11 -O3 -g -o 2048 2048.cpp' to compile the source
+ * use 'g++ -std=c++11 -O3 -g -pthread -o 2048 2048.cpp' to compile the source
  *
  * Computer Games and Intelligence (CGI) Lab, NCTU, Taiwan
  * http://www.aigames.nctu.edu.tw
@@ -10,21 +10,47 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <thread>
+#include <deque>
+#include <random>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistic.h"
+#include "timer.h"
+#include "server.h"
 
-int main(int argc, const char* argv[]) {
-	std::cout << "2048-Demo: ";
-	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
-	std::cout << std::endl << std::endl;
+/**
+ * play the moves of an episode until the game ends, return the winner
+ * (add) the phases of the moves are recorded into the timer
+ */
+agent& run_episode(episode& game, agent& play, agent& evil, timer& clock) {
+	game.profile(&clock);
+	while (true) {
+		agent& who = game.take_turns(play, evil);
+		action move = who.take_action(game.state());
+		if (game.apply_action(move) != true) break;
+		if (who.check_for_win(game.state())) break;
+	}
+	game.profile(nullptr);
+	return game.last_turns(play, evil);
+}
 
-	size_t total = 1000, block = 0, limit = 0;
+/**
+ * the player learns from the episode (see learning_player::close_episode), which is recorded as the learn phase
+ */
+void learn_episode(agent& play, const std::string& flag, timer& clock) {
+	timer::tick start = timer::now();
+	play.close_episode(flag);
+	clock.record(timer::learn, timer::now() - start);
+}
+
+int main(int argc, const char* argv[]) {
+	size_t total = 1000, block = 0, limit = 0, threads = 1;
 	std::string play_args, evil_args;
-	std::string load, save;
-	bool summary = false;
+	std::string load, save, serve;
+	bool summary = false, binary = false, streaming = false, timing = false;
 	for (int i = 1; i < argc; i++) {
 		std::string para(argv[i]);
 		if (para.find("--total=") == 0) {
@@ -33,6 +59,8 @@ int main(int argc, const char* argv[]) {
 			block = std::stoull(para.substr(para.find("=") + 1));
 		} else if (para.find("--limit=") == 0) {
 			limit = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--threads=") == 0) {
+			threads = std::stoull(para.substr(para.find("=") + 1));
 		} else if (para.find("--play=") == 0) {
 			play_args = para.substr(para.find("=") + 1);
 		} else if (para.find("--evil=") == 0) {
@@ -43,38 +71,132 @@ int main(int argc, const char* argv[]) {
 			save = para.substr(para.find("=") + 1);
 		} else if (para.find("--summary") == 0) {
 			summary = true;
+		} else if (para.find("--format=") == 0) {
+			binary = (para.substr(para.find("=") + 1) == "binary");
+		} else if (para.find("--stream") == 0) {
+			streaming = true;
+		} else if (para.find("--timing") == 0) {
+			timing = true;
+		} else if (para.find("--serve") == 0) {
+			serve = (para.find("=") != std::string::npos) ? para.substr(para.find("=") + 1) : "-";
 		}
 	}
 
+	// the stdout is for the responses when serving on stdin/stdout
+	std::ostream& info = (serve == "-") ? std::cerr : std::cout;
+	info << "2048-Demo: ";
+	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(info, " "));
+	info << std::endl << std::endl;
+
+	if (serve.size()) {
+		// answer the queries of boards (see server.h) with --threads workers, the player never learns
+		learning_player play(play_args + " alpha=0");
+		server host(play, threads);
+		if (serve != "-") host.listen(serve);
+		host.serve(STDIN_FILENO, STDOUT_FILENO);
+		std::cerr << host.latency();
+		return 0;
+	}
+
 	statistic stat(total, block, limit);
 
 	if (load.size()) {
-		std::ifstream in(load, std::ios::in);
-		in >> stat;
+		// either a binary episode log (see statistic::write) or the text format
+		std::ifstream in(load, std::ios::in | std::ios::binary);
+		if (!statistic::is_log(in)) {
+			in >> stat;
+		} else if (!stat.read(in)) {
+			std::cerr << "broken episode log " << load << ", " << stat.size() << " episodes loaded" << std::endl;
+		}
 		in.close();
 		summary |= stat.is_finished();
 	}
 
+	// streaming: the episodes are saved as soon as they are closed, and only the aggregates are kept
+	std::ofstream sink;
+	if (streaming && save.size()) {
+		sink.open(save, binary ? (std::ios::out | std::ios::trunc | std::ios::binary) : (std::ios::out | std::ios::trunc));
+		stat.stream(sink, binary);
+	}
+
 	// player play(play_args);
 	learning_player play(play_args);
 	rndenv evil(evil_args);
 
+	// each thread plays with its own copy of the player, which shares the weight tables,
+	// and with its own environment, seeded by (seed + thread id)
+	unsigned seed = std::random_device()();
+	if (evil_args.find("seed=") != std::string::npos)
+		seed = std::stoul(evil.property("seed"));
+	std::vector<std::thread> workers;
+	std::vector<timer> clocks(threads); // the phases of each thread, reported in total at exit
+	timer clock;
+
+	if (threads > 1 && !play.learning() && !sink.is_open()) {
+		// pure inference: each thread plays a fixed share of the games into its own statistic,
+		// and the shards are merged in thread order afterward
+		size_t games = total - std::min(total, stat.size());
+		std::deque<statistic> shards;
+		for (size_t id = 0, offset = stat.size(); id < threads; id++) {
+			size_t share = games / threads + (id < games % threads);
+			shards.emplace_back(share, 0, limit);
+			shards.back().follow(stat, offset); // shards never show, their blocks are shown by merge()
+			offset += share;
+		}
+		for (size_t id = 0; id < threads; id++) {
+			workers.emplace_back([&, id]() {
+				learning_player play_local(play);
+				rndenv evil_local(evil_args + " seed=" + std::to_string(seed + id));
+				statistic& shard = shards[id];
+				while (!shard.is_finished()) {
+					play_local.open_episode("~:" + evil_local.name());
+					evil_local.open_episode(play_local.name() + ":~");
+
+					shard.open_episode(play_local.name() + ":" + evil_local.name());
+					agent& win = run_episode(shard.back(), play_local, evil_local, clocks[id]);
+					shard.close_episode(win.name());
+
+					learn_episode(play_local, win.name(), clocks[id]);
+					evil_local.close_episode(win.name());
+				}
+			});
+		}
+		for (std::thread& worker : workers) worker.join();
+		for (statistic& shard : shards) stat.merge(shard);
+
+	} else if (threads > 1) {
+		for (size_t id = 0; id < threads; id++) {
+			workers.emplace_back([&, id]() {
+				learning_player play_local(play);
+				rndenv evil_local(evil_args + " seed=" + std::to_string(seed + id));
+				episode game;
+				while (stat.reserve()) {
+					play_local.open_episode("~:" + evil_local.name());
+					evil_local.open_episode(play_local.name() + ":~");
+
+					game.clear();
+					game.open_episode(play_local.name() + ":" + evil_local.name());
+					agent& win = run_episode(game, play_local, evil_local, clocks[id]);
+					game.close_episode(win.name());
+					stat.commit(std::move(game));
+
+					learn_episode(play_local, win.name(), clocks[id]);
+					evil_local.close_episode(win.name());
+				}
+			});
+		}
+		for (std::thread& worker : workers) worker.join();
+	}
+
 	while (!stat.is_finished()) {
 		play.open_episode("~:" + evil.name());
 		evil.open_episode(play.name() + ":~");
 
 		stat.open_episode(play.name() + ":" + evil.name());
-		episode& game = stat.back();
-		while (true) {
-			agent& who = game.take_turns(play, evil);
-			action move = who.take_action(game.state());
-			if (game.apply_action(move) != true) break;
-			if (who.check_for_win(game.state())) break;
-		}
-		agent& win = game.last_turns(play, evil);
+		agent& win = run_episode(stat.back(), play, evil, clock);
 		stat.close_episode(win.name());
 
-		play.close_episode(win.name());
+		learn_episode(play, win.name(), clock);
 		evil.close_episode(win.name());
 	}
 
@@ -82,9 +204,18 @@ int main(int argc, const char* argv[]) {
 		stat.summary();
 	}
 
-	if (save.size()) {
-		std::ofstream out(save, std::ios::out | std::ios::trunc);
-		out << stat;
+	if (timing) {
+		for (const timer& t : clocks) clock.merge(t);
+		std::cout << clock;
+	}
+
+	if (sink.is_open()) {
+		stat.close_stream();
+		sink.close();
+	} else if (save.size()) {
+		std::ofstream out(save, binary ? (std::ios::out | std::ios::trunc | std::ios::binary) : (std::ios::out | std::ios::trunc));
+		if (binary) stat.write(out);
+		else out << stat;
 		out.close();
 	}
 
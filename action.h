@@ -2,50 +2,66 @@
 #include <algorithm>
 #include <unordered_map>
 #include <string>
+#include <iostream>
+#include <type_traits>
 #include "board.h"
 
+/**
+ * (add) an action is a plain 32-bit code (the type flag and the event), trivially copyable,
+ * applied by a switch over the type in the game loop
+ * the prototype registry of the types is only used for the text I/O
+ */
 class action {
 public:
 	action(unsigned code = -1u) : code(code) {}
-	action(const action& a) : code(a.code) {}
-	virtual ~action() {}
 
 	class slide; // create a sliding action with board opcode
 	class place; // create a placing action with position and tile
 
 public:
-	virtual board::reward apply(board& b) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
-		return -1;
-	}
-	virtual std::ostream& operator >>(std::ostream& out) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this) >> out;
+	board::reward apply(board& b) const; // see below
+
+public:
+	operator unsigned() const { return code; }
+	unsigned type() const { return code & type_flag(-1u); }
+	unsigned event() const { return code & ~type(); }
+	friend std::ostream& operator <<(std::ostream& out, const action& a) {
+		auto proto = entries().find(a.type());
+		if (proto != entries().end()) return proto->second.write(out, a);
 		return out << "??";
 	}
-	virtual std::istream& operator <<(std::istream& in) {
+	friend std::istream& operator >>(std::istream& in, action& a) {
 		auto state = in.rdstate();
 		for (auto proto = entries().begin(); proto != entries().end(); proto++) {
-			if (proto->second->reinterpret(this) << in) return in;
+			if (proto->second.read(in, a)) return in;
 			in.clear(state);
 		}
 		return in.ignore(2);
 	}
 
-public:
-	operator unsigned() const { return code; }
-	unsigned type() const { return code & type_flag(-1u); }
-	unsigned event() const { return code & ~type(); }
-	friend std::ostream& operator <<(std::ostream& out, const action& a) { return a >> out; }
-	friend std::istream& operator >>(std::istream& in, action& a) { return a << in; }
-
 protected:
 	static constexpr unsigned type_flag(unsigned v) { return v << 24; }
 
-	typedef std::unordered_map<unsigned, action*> prototype;
-	static prototype& entries() { static prototype m; return m; }
-	virtual action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) action(*a); }
+	/**
+	 * the text I/O of a type of action, see format<derived>
+	 */
+	struct prototype {
+		std::ostream& (*write)(std::ostream& out, const action& a);
+		std::istream& (*read)(std::istream& in, action& a);
+	};
+	typedef std::unordered_map<unsigned, prototype> registry;
+	static registry& entries() { static registry m; return m; }
+
+	template<typename derived>
+	static std::ostream& format_write(std::ostream& out, const action& a) { return derived(a) >> out; }
+	template<typename derived>
+	static std::istream& format_read(std::istream& in, action& a) {
+		derived d;
+		if (d << in) a = d;
+		return in;
+	}
+	template<typename derived>
+	static prototype format() { return { &format_write<derived>, &format_read<derived> }; }
 
 	unsigned code;
 };
@@ -77,8 +93,7 @@ public:
 		return in;
 	}
 protected:
-	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) slide(*a); }
-	static __attribute__((constructor)) void init() { entries()[type_flag('s')] = new slide; }
+	static __attribute__((constructor)) void init() { entries()[type_flag('s')] = format<slide>(); }
 };
 
 class action::place : public action {
@@ -112,6 +127,15 @@ public:
 		return in;
 	}
 protected:
-	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) place(*a); }
-	static __attribute__((constructor)) void init() { entries()[type_flag('p')] = new place; }
+	static __attribute__((constructor)) void init() { entries()[type_flag('p')] = format<place>(); }
 };
+
+inline board::reward action::apply(board& b) const {
+	switch (type()) {
+	case slide::type: return slide(*this).apply(b);
+	case place::type: return place(*this).apply(b);
+	default:          return -1;
+	}
+}
+
+static_assert(std::is_trivially_copyable<action>::value && sizeof(action) == sizeof(unsigned), "action should be a plain code");
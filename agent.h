@@ -8,7 +8,19 @@
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "pattern.h"
+#include "trajectory.h"
+#include "cache.h"
 #include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <dirent.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 class agent {
 public:
@@ -43,6 +55,46 @@ protected:
 	std::map<key, value> meta;
 };
 
+/**
+ * xoshiro256** pseudorandom generator (Blackman and Vigna), seeded by splitmix64,
+ * a 64-bit UniformRandomBitGenerator much cheaper than std::default_random_engine
+ */
+class xoshiro {
+public:
+	typedef uint64_t result_type;
+	xoshiro(uint64_t seed = 0) { this->seed(seed); }
+
+	void seed(uint64_t seed) {
+		for (uint64_t& x : s) {
+			uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			x = z ^ (z >> 31);
+		}
+	}
+	result_type operator()() {
+		uint64_t v = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return v;
+	}
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return -1ull; }
+
+	/**
+	 * a uniform integer in [0, n) by multiplying the upper 32 bits (Lemire), the bias is negligible for small n
+	 */
+	uint32_t below(uint32_t n) { return uint32_t(((operator()() >> 32) * n) >> 32); }
+
+private:
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+	uint64_t s[4];
+};
+
 class random_agent : public agent {
 public:
 	random_agent(const std::string& args = "") : agent(args) {
@@ -61,11 +113,30 @@ protected:
  */
 class weight_agent : public agent {
 public:
-	weight_agent(const std::string& args = "") : agent(args) {
+	weight_agent(const std::string& args = "") : agent(args), episodes(std::make_shared<std::atomic<uint64_t>>(0)) {
+		// pass tuple=... to choose the patterns of the network, see pattern::parse
+		tuples = pattern::parse(meta.find("tuple") != meta.end() ? meta["tuple"] : std::string("legacy"));
+		if (meta.find("resume") != meta.end() && meta.find("save") != meta.end()) // pass resume to load the latest of save=... and its checkpoints
+			resume_weights(meta["save"]);
 		if (meta.find("init") != meta.end()) // pass init=... to initialize the weight
 			init_weights(meta["init"]);
 		if (meta.find("load") != meta.end()) // pass load=... to load from a specific file
 			load_weights(meta["load"]);
+		if (meta.find("quantize") != meta.end()) // pass quantize=int16 to convert the weight for inference
+			quantize_weights(meta["quantize"]);
+		if (meta.find("pages") != meta.end()) // pass pages=thp|huge and numa=interleave|replica, see memory_policy
+			memory.pages = (property("pages") == "huge") ? memory_policy::huge : (property("pages") == "thp") ? memory_policy::thp : memory_policy::small;
+		if (meta.find("numa") != meta.end())
+			memory.numa = (property("numa") == "replica") ? memory_policy::replica : (property("numa") == "interleave") ? memory_policy::interleave : memory_policy::local;
+		if (memory.custom()) place_weights();
+	}
+	/**
+	 * a copy shares the weight tables with the origin (e.g., for multi-threaded self-play),
+	 * and only the origin saves them
+	 */
+	weight_agent(const weight_agent& a) : agent(a), tuples(a.tuples), net(a.net), qnet(a.qnet), episodes(a.episodes), memory(a.memory), replicas(a.replicas) {
+		meta.erase("save");
+		if (memory.numa == memory_policy::replica) replicate();
 	}
 	virtual ~weight_agent() {
 		if (meta.find("save") != meta.end()) // pass save=... to save to a specific file
@@ -74,19 +145,201 @@ public:
 
 protected:
 	virtual void init_weights(const std::string& info) {
-		// add : actually we just need 15^4 for threes instead of 2^16 for 2048
-		// here we use 2^16 for converting the index easier
-		net.emplace_back(65536); 
-		net.emplace_back(65536); 
-		net.emplace_back(65536); 
-		net.emplace_back(65536); 
-		net.emplace_back(65536); 
-		net.emplace_back(65536); 
-		net.emplace_back(65536); 
-		net.emplace_back(65536); 
-		// now net.size() == 2; net[0].size() == 65536; net[1].size() == 65536
+		// add : one table per pattern, shared by all its isomorphisms
+		// the legacy network uses 2^16 for 4 tiles for converting the index easier
+		for (const pattern& p : tuples) net.emplace_back(p.size());
 	}
 	virtual void load_weights(const std::string& path) {
+		size_t len = 0;
+		std::shared_ptr<char> file = weight::map(path, len);
+		if (!file) std::exit(-1);
+		const file_header& head = *reinterpret_cast<const file_header*>(file.get());
+		if (len < sizeof(file_header) || std::string(head.magic, 8) != std::string(file_magic, 8)) {
+			load_legacy_weights(path);
+			return;
+		}
+		if (head.version < 1 || head.version > file_version || head.dtype > dtype_int16 || len < sizeof(file_header) + uint64_t(head.tables) * sizeof(file_table)) {
+			std::cerr << "unsupported weight file " << path << std::endl;
+			std::exit(-1);
+		}
+		// the tables are used in place, and the layout of the file replaces the tuple=... patterns
+		tuples.clear();
+		net.clear();
+		qnet.clear();
+		bool valid = (head.dtype == dtype_int16) ? map_tables(file, len, qnet) : map_tables(file, len, net);
+		if (!valid) {
+			std::cerr << "broken weight file " << path << std::endl;
+			std::exit(-1);
+		}
+		if (meta.find("resume") != meta.end()) *episodes = head.episodes;
+	}
+	virtual void save_weights(const std::string& path) {
+		bool done = net.size() ? write_file(path, tuples, net, dtype_float, *episodes) : write_file(path, tuples, qnet, dtype_int16, *episodes);
+		if (!done) std::exit(-1);
+	}
+	/**
+	 * take the file of the most trained episodes among the saved weights and the checkpoints (see learning_agent),
+	 * i.e., PATH and PATH.E for any E, as load=... and continue its count of episodes
+	 */
+	void resume_weights(const std::string& path) {
+		std::vector<std::string> files = { path };
+		for (const std::pair<uint64_t, std::string>& e : checkpoints(path)) files.push_back(e.second);
+		std::string latest;
+		uint64_t most = 0;
+		for (const std::string& file : files) {
+			file_header head = {};
+			std::ifstream in(file, std::ios::in | std::ios::binary);
+			if (!in.read(reinterpret_cast<char*>(&head), sizeof(head)) || std::string(head.magic, 8) != std::string(file_magic, 8)) continue;
+			if (latest.empty() || head.episodes > most) latest = file, most = head.episodes;
+		}
+		if (latest.size()) {
+			meta["load"] = { latest };
+		} else if (meta.find("init") == meta.end() && meta.find("load") == meta.end()) {
+			std::cerr << "nothing to resume from " << path << ", start with init" << std::endl;
+			meta["init"] = { "" };
+		}
+	}
+	/**
+	 * the checkpoints of PATH, i.e., the files PATH.E for any E, sorted by E
+	 */
+	static std::vector<std::pair<uint64_t, std::string>> checkpoints(const std::string& path) {
+		size_t slash = path.find_last_of('/');
+		std::string dir = (slash != std::string::npos) ? path.substr(0, slash + 1) : "./";
+		std::string base = path.substr(slash + 1);
+		std::vector<std::pair<uint64_t, std::string>> files;
+		if (DIR* d = opendir(dir.c_str())) {
+			while (dirent* e = readdir(d)) {
+				std::string name = e->d_name;
+				if (name.size() > base.size() + 1 && name.size() < base.size() + 20 && name.compare(0, base.size() + 1, base + ".") == 0
+						&& name.find_first_not_of("0123456789", base.size() + 1) == std::string::npos)
+					files.emplace_back(std::stoull(name.substr(base.size() + 1)), dir + name);
+			}
+			closedir(d);
+		}
+		std::sort(files.begin(), files.end());
+		return files;
+	}
+	virtual void quantize_weights(const std::string& type) {
+		if (type != "int16") {
+			std::cerr << "unsupported quantization " << type << std::endl;
+			std::exit(-1);
+		}
+		for (const weight& w : net) qnet.push_back(qweight::quantize(w));
+		net.clear();
+	}
+
+	/**
+	 * move the tables into the memory of the policy, once they are initialized, loaded, or quantized
+	 * with numa=replica, they are the replica of the current node
+	 */
+	void place_weights() {
+		for (weight& w : net) w = w.clone(memory);
+		for (qweight& w : qnet) w = w.clone(memory);
+		if (memory.numa != memory_policy::replica) return;
+		replicas = std::make_shared<replica_set>();
+		replicas->nodes[memory_policy::current_node()] = { net, qnet };
+	}
+	/**
+	 * share the replica of the node which this copy is made on, or make one if the node has none
+	 * the copies are made by the threads that use them, see 2048.cpp
+	 */
+	void replicate() {
+		int node = memory_policy::current_node();
+		std::lock_guard<std::mutex> lock(replicas->lock);
+		auto it = replicas->nodes.find(node);
+		if (it == replicas->nodes.end()) {
+			auto& tables = replicas->nodes[node];
+			for (const weight& w : net) tables.first.push_back(w.clone(memory, node));
+			for (const qweight& w : qnet) tables.second.push_back(w.clone(memory, node));
+			it = replicas->nodes.find(node);
+		}
+		net = it->second.first;
+		qnet = it->second.second;
+	}
+
+	template<typename table>
+	bool map_tables(const std::shared_ptr<char>& file, size_t len, std::vector<table>& tables) {
+		typedef typename table::value_type type;
+		const file_header& head = *reinterpret_cast<const file_header*>(file.get());
+		const file_table* desc = reinterpret_cast<const file_table*>(file.get() + sizeof(file_header));
+		uint32_t crc = 0;
+		if (head.version >= 2) { // the header (with crc as 0) and the descriptors are also covered
+			file_header h = head;
+			h.crc = 0;
+			crc = weight::crc32(&h, sizeof(h), crc);
+			crc = weight::crc32(desc, head.tables * sizeof(file_table), crc);
+		}
+		for (size_t i = 0; i < head.tables; i++) {
+			const file_table& t = desc[i];
+			if (!valid_table(t) || t.offset % sizeof(type) || t.offset > len || t.length > (len - t.offset) / sizeof(type)) return false;
+			tuples.emplace_back(std::vector<int>(t.cells, t.cells + t.size), t.isomorphisms, t.radix);
+			if (tuples.back().size() != t.length) return false;
+			tables.emplace_back(reinterpret_cast<type*>(file.get() + t.offset), t.length, file, t.scale);
+			crc = tables.back().crc32(crc);
+		}
+		return crc == head.crc;
+	}
+
+	/**
+	 * write the tables to a new file, flush it to the disk, and rename it, so that the file is always complete
+	 * (the old file may also be still mapped by the tables)
+	 * it takes no members, so that it can run on a thread of its own (see learning_agent::checkpoint)
+	 */
+	template<typename table>
+	static bool write_file(const std::string& path, const std::vector<pattern>& tuples, const std::vector<table>& tables, uint32_t dtype, uint64_t episodes) {
+		std::string temp = path + ".tmp";
+		std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		write_tables(out, tuples, tables, dtype, episodes);
+		out.close();
+		int fd = open(temp.c_str(), O_RDONLY);
+		bool synced = (fd >= 0 && fsync(fd) == 0);
+		if (fd >= 0) close(fd);
+		return out && synced && std::rename(temp.c_str(), path.c_str()) == 0;
+	}
+
+	template<typename table>
+	static void write_tables(std::ostream& out, const std::vector<pattern>& tuples, const std::vector<table>& tables, uint32_t dtype, uint64_t episodes) {
+		typedef typename table::value_type type;
+		file_header head = {};
+		std::copy(file_magic, file_magic + 8, head.magic);
+		head.version = file_version;
+		head.dtype = dtype;
+		head.tables = tables.size();
+		head.episodes = episodes;
+
+		std::vector<file_table> desc(tables.size());
+		uint64_t offset = sizeof(file_header) + tables.size() * sizeof(file_table);
+		for (size_t i = 0; i < tables.size(); i++) {
+			file_table& t = desc[i];
+			offset = (offset + file_align - 1) / file_align * file_align;
+			t.offset = offset;
+			t.length = tables[i].size();
+			t.scale = tables[i].scale();
+			t.radix = tuples[i].radix();
+			t.isomorphisms = tuples[i].isomorphisms();
+			std::vector<int> cells = tuples[i].cells();
+			t.size = cells.size();
+			std::copy(cells.begin(), cells.end(), t.cells);
+			offset += t.length * sizeof(type);
+		}
+		uint32_t crc = weight::crc32(&head, sizeof(head)); // with crc as 0
+		crc = weight::crc32(desc.data(), desc.size() * sizeof(file_table), crc);
+		for (const table& w : tables) crc = w.crc32(crc);
+		head.crc = crc;
+		out.write(reinterpret_cast<char*>(&head), sizeof(head));
+		out.write(reinterpret_cast<char*>(desc.data()), desc.size() * sizeof(file_table));
+		for (const table& w : tables) {
+			std::vector<char> pad((file_align - out.tellp() % file_align) % file_align);
+			out.write(pad.data(), pad.size());
+			out.write(reinterpret_cast<const char*>(&w[0]), sizeof(type) * w.size());
+		}
+	}
+
+	/**
+	 * the original format: the number of tables, then each table as its size and entries
+	 */
+	void load_legacy_weights(const std::string& path) {
 		std::ifstream in(path, std::ios::in | std::ios::binary);
 		if (!in.is_open()) std::exit(-1);
 		uint32_t size;
@@ -94,88 +347,406 @@ protected:
 		net.resize(size);
 		for (weight& w : net) in >> w;
 		in.close();
+		bool match = (net.size() == tuples.size());
+		for (size_t i = 0; match && i < net.size(); i++) match = (net[i].size() == tuples[i].size());
+		if (!match) {
+			std::cerr << "weights in " << path << " do not match the tuple patterns" << std::endl;
+			std::exit(-1);
+		}
 	}
-	virtual void save_weights(const std::string& path) {
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
-		if (!out.is_open()) std::exit(-1);
-		uint32_t size = net.size();
-		out.write(reinterpret_cast<char*>(&size), sizeof(size));
-		for (weight& w : net) out << w;
-		out.close();
+
+protected:
+	/**
+	 * weight file format (version 2), little-endian
+	 *   file_header, then a file_table per table, then the tables, each aligned to a page
+	 * the CRC covers the header (with crc as 0), the descriptors, and the tables (only the tables in version 1)
+	 * a loaded file is mapped into memory privately, so the processes on a host share its pages
+	 */
+	static constexpr const char* file_magic = "TCGTHREE";
+	enum { file_align = 4096, file_version = 2 };
+	enum { dtype_float = 0, dtype_int16 = 1 };
+	struct file_header {
+		char magic[8];
+		uint32_t version;
+		uint32_t dtype;		// 0 for float, 1 for int16 (quantized)
+		uint32_t tables;
+		uint32_t crc;		// CRC-32 of the header, the descriptors, and all tables in order
+		uint64_t episodes;	// the trained episodes, for resuming a training
+		uint8_t reserved[32];
+	};
+	struct file_table {
+		uint64_t offset;	// of the table from the beginning of the file
+		uint64_t length;	// number of entries
+		uint32_t radix;
+		uint16_t isomorphisms;
+		uint16_t size;		// number of cells
+		uint8_t cells[16];
+		float scale;		// of the entries, see basic_weight::scale
+		uint8_t reserved[4];
+	};
+	static_assert(sizeof(file_header) == 64 && sizeof(file_table) == 48, "unexpected padding in the weight file format");
+
+	/**
+	 * whether a table descriptor makes a valid pattern, checked before the pattern is constructed
+	 */
+	static bool valid_table(const file_table& t) {
+		if (t.size < 1 || t.size > 16 || t.radix < 2 || t.radix > 16 || t.isomorphisms < 1 || t.isomorphisms > 8) return false;
+		uint64_t entries = 1;
+		for (size_t k = 0; k < t.size; k++) {
+			if (t.cells[k] >= 16) return false;
+			entries *= t.radix;
+			if (entries > (uint64_t(1) << 32)) return false; // the indices are 32-bit
+		}
+		return true;
 	}
 
 protected:
+	std::vector<pattern> tuples;
 	std::vector<weight> net;
+	std::vector<qweight> qnet;	// the quantized network, which replaces net for inference
+	std::shared_ptr<std::atomic<uint64_t>> episodes;	// trained into the tables, shared by the copies as the tables
+
+	memory_policy memory;
+	struct replica_set {
+		std::mutex lock;
+		std::map<int, std::pair<std::vector<weight>, std::vector<qweight>>> nodes;
+	};
+	std::shared_ptr<replica_set> replicas;	// the tables of each node with numa=replica, shared by the copies
 };
 
 /**
  * base agent for agents with a learning rate
  * (add) we modify here
+ *
+ * (add) tc : temporal coherence learning, each entry adapts its rate by alpha * |sum of errors| / sum of |errors|
+ *            (alpha=1 is the usual choice), the accumulators are not saved with the weights
+ *       schedule=N:A,... : use alpha=A from the N-th trained episode on, e.g., schedule=100000:0.05,200000:0.01
+ *       simd=0 : evaluate the afterstates one by one, instead of by AVX2 gathers (see state_values)
+ *       checkpoint=N : save the weights to PATH.E every N trained episodes (E), where PATH is save=PATH,
+ *                      on a thread of its own from a snapshot of the tables, and keep the last K, see keep=K,
+ *                      the snapshot is copied 4MB per trained episode, so it also has the updates of those episodes
+ *       keep=K : the checkpoints to keep, 2 by default
+ *       resume : continue from the latest of save=PATH and its checkpoints, with its count of episodes (see weight_agent)
  */
 class learning_agent : public weight_agent {
 public:
-	learning_agent(const std::string& args = "") : weight_agent(args), alpha(0.1f) {
+	learning_agent(const std::string& args = "") : weight_agent(args), alpha(0.1f), every(0), keep(2), saver(std::make_shared<checkpointer>()) {
 		if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]);
+		if (meta.find("schedule") != meta.end()) {
+			std::stringstream ss(property("schedule"));
+			for (std::string stage; std::getline(ss, stage, ','); )
+				schedule.emplace_back(std::stoull(stage.substr(0, stage.find(':'))), std::stof(stage.substr(stage.find(':') + 1)));
+			std::sort(schedule.begin(), schedule.end());
+			for (const std::pair<uint64_t, float>& stage : schedule) // the stage of a resumed run
+				if (*episodes && *episodes >= stage.first) alpha = stage.second;
+		}
+		if (meta.find("checkpoint") != meta.end() && learning()) {
+			if (meta.find("save") == meta.end()) {
+				std::cerr << "checkpoint=... needs save=... for the path of the checkpoints" << std::endl;
+				std::exit(-1);
+			}
+			every = uint64_t(meta["checkpoint"]);
+			prefix = property("save");
+		}
+		if (meta.find("keep") != meta.end())
+			keep = std::max(int(meta["keep"]), 1);
+		if (meta.find("tc") != meta.end() && learning())
+			for (const weight& w : net) tc.push_back(memory.custom() ? cweight(w.size(), memory) : cweight(w.size()));
+		if (qnet.size() && learning()) {
+			std::cerr << "quantized weights are for inference only, use alpha=0" << std::endl;
+			std::exit(-1);
+		}
+		if (memory.numa == memory_policy::replica && learning()) {
+			std::cerr << "replicated weights are for inference only, use alpha=0" << std::endl;
+			std::exit(-1);
+		}
+		legacy = (tuples.size() == 8);
+		for (size_t i = 0; legacy && i < tuples.size(); i++) legacy = tuples[i].is_line(i);
+		simd = qnet.empty() && has_avx2() && (meta.find("simd") == meta.end() || int(meta["simd"]));
+		if (num_features() > max_features) {
+			std::cerr << "too many tuples: " << num_features() << " > " << max_features << std::endl;
+			std::exit(-1);
+		}
 	}
 	virtual ~learning_agent() {}
 
+	// alpha=0 means pure inference, the weights are never written
+	bool learning() const { return alpha != 0; }
+
+	/**
+	 * count a trained episode (of all copies), and take the alpha of the schedule stage it reaches
+	 */
+	void count_episode() {
+		uint64_t n = ++(*episodes);
+		for (const std::pair<uint64_t, float>& stage : schedule)
+			if (n >= stage.first) alpha = stage.second;
+		if (every && n % every == 0) checkpoint(n);
+		if (every && saver->episodes) {
+			std::unique_lock<std::mutex> lock(saver->lock, std::try_to_lock); // another copy may be copying the slice
+			if (lock.owns_lock()) copy_slice();
+		}
+	}
+
+	/**
+	 * start a checkpoint of n episodes: the tables are copied into the snapshot a slice per trained episode (see copy_slice),
+	 * so that no episode waits long for the copying, and written by the thread of the saver,
+	 * a checkpoint is skipped if the last one is still being copied or written
+	 */
+	void checkpoint(uint64_t n) {
+		std::lock_guard<std::mutex> lock(saver->lock);
+		if (saver->writing || saver->episodes) {
+			std::cerr << "skip the checkpoint of " << n << " episodes, the last one is still being saved" << std::endl;
+			return;
+		}
+		if (saver->writer.joinable()) saver->writer.join();
+		std::vector<weight>& snapshot = saver->snapshot;
+		if (snapshot.size() != net.size()) snapshot.assign(net.size(), weight());
+		for (size_t i = 0; i < net.size(); i++)
+			if (snapshot[i].size() != net[i].size()) snapshot[i] = weight(net[i].size());
+		saver->table = saver->entry = 0;
+		saver->episodes = n;
+	}
+	/**
+	 * copy the next slice of the tables into the snapshot of the checkpoint in progress (with the lock of the saver),
+	 * and start writing the snapshot once it is complete
+	 */
+	void copy_slice() {
+		checkpointer& s = *saver;
+		if (!s.episodes) return;
+		for (size_t budget = checkpoint_slice; budget && s.table < net.size(); ) {
+			weight& w = net[s.table];
+			size_t len = std::min(budget, w.size() - s.entry);
+			std::copy(&w[0] + s.entry, &w[0] + s.entry + len, &s.snapshot[s.table][0] + s.entry);
+			s.entry += len;
+			budget -= len;
+			if (s.entry == w.size()) s.table++, s.entry = 0;
+		}
+		if (s.table < net.size()) return;
+		uint64_t n = s.episodes;
+		s.episodes = 0;
+		std::string prefix = this->prefix, file = prefix + "." + std::to_string(n);
+		std::vector<pattern> tuples = this->tuples;
+		uint64_t keep = this->keep;
+		checkpointer* saver = this->saver.get();	// which outlives the thread, see ~checkpointer
+		saver->writing = true;
+		saver->writer = std::thread([=]() {
+			if (!write_file(file, tuples, saver->snapshot, dtype_float, n)) {
+				std::cerr << "failed to save the checkpoint " << file << std::endl;
+			} else { // remove all but the last K up to this one, also those of a resumed run or before a skipped checkpoint
+				std::vector<std::pair<uint64_t, std::string>> files = checkpoints(prefix);
+				size_t last = std::upper_bound(files.begin(), files.end(), std::make_pair(n, file)) - files.begin();
+				for (size_t i = 0; i + keep < last; i++) std::remove(files[i].second.c_str());
+			}
+			saver->writing = false;
+		});
+	}
+
 	// add utilities
-	float decode(const board& state, int t1, int t2, int t3, int t4) const{
+	int decode(const board& state, int t1, int t2, int t3, int t4) const{
 		// change board info to net index
-		uint32_t space[] = {0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144};
-		int s1, s2, s3, s4; s1=s2=s3=s4=0;
-		while(state(t1)!=space[s1] && s1 < 15) ++s1; 
-		while(state(t2)!=space[s2] && s2 < 15) ++s2; 
-		while(state(t3)!=space[s3] && s3 < 15) ++s3; 
-		while(state(t4)!=space[s4] && s4 < 15) ++s4; 
-		//std::cout << "----------------------------------------------------" <<std::endl;
-		//std::cout << (s1) << " " << (s2) << " " << (s3) << " " <<(s4) <<std::endl;
-		//std::cout << (s1<<12) + (s2<<8) + (s3<<4) +(s4) <<std::endl;
-		//std::cout << "----------------------------------------------------" <<std::endl;
-		return (s1<<12) + (s2<<8) + (s3<<4) +(s4);	// use 16 for conv
+		// (the board keeps tile indices, so no search over tile values is needed)
+		return (state(t1)<<12) + (state(t2)<<8) + (state(t3)<<4) + (state(t4));	// use 16 for conv
 	}
 
-	float state_value(const board& s) const{
+	/**
+	 * net index of all tuples (all isomorphisms of each pattern), extracted in one pass
+	 * e.g., for the legacy network, features[i] == decode(s, ...) of the i-th row or column
+	 */
+	enum { max_features = 64 };
+	typedef std::array<uint32_t, max_features> features;
+	void extract(const board& s, features& f) const {
+		if (legacy) {
+			for (int i = 0; i < 4; i++) f[i] = s.row(i);
+			for (int i = 0; i < 4; i++) f[i + 4] = s.col(i);
+			return;
+		}
+		std::array<uint8_t, 16> tile;
+		for (int i = 0; i < 16; i++) tile[i] = s(i);
+		size_t k = 0;
+		for (const pattern& p : tuples)
+			for (size_t i = 0; i < p.isomorphisms(); i++) f[k++] = p.index(tile, i);
+	}
+	size_t num_features() const {
+		size_t k = 0;
+		for (const pattern& p : tuples) k += p.isomorphisms();
+		return k;
+	}
+
+	float state_value(const features& f) const{
+		return state_value(f.data());
+	}
+	float state_value(const uint32_t* idx) const{
+		if (qnet.size()) return quantized_value(idx);
+		float V=0;
+		if (legacy) {
+			for (int i = 0; i < 8; i++) V += net[i][idx[i]];
+			return V;
+		}
+		for (size_t t = 0; t < tuples.size(); t++) {
+			const weight& w = net[t];
+			for (size_t i = 0; i < tuples[t].isomorphisms(); i++) V += w[*(idx++)];
+		}
+		return V;
+	}
+	float quantized_value(const uint32_t* idx) const{
 		float V=0;
-		V += net[0][decode(s,0,1,2,3)];
-		V += net[1][decode(s,4,5,6,7)];
-		V += net[2][decode(s,8,9,10,11)];
-		V += net[3][decode(s,12,13,14,15)];
-		V += net[4][decode(s,0,4,8,12)];
-		V += net[5][decode(s,1,5,9,13)];
-		V += net[6][decode(s,2,6,10,14)];
-		V += net[7][decode(s,3,7,11,15)];
-		//std::cout << "----------------------------------------------------" <<std::endl;
-		//std::cout << V <<std::endl;
-		//std::cout << "----------------------------------------------------" <<std::endl;
+		if (legacy) {
+			for (int i = 0; i < 8; i++) V += qnet[i][idx[i]] * qnet[i].scale();
+			return V;
+		}
+		for (size_t t = 0; t < tuples.size(); t++) {
+			const qweight& w = qnet[t];
+			int32_t v = 0;
+			for (size_t i = 0; i < tuples[t].isomorphisms(); i++) v += w[*(idx++)];
+			V += v * w.scale();
+		}
 		return V;
 	}
+	float state_value(const board& s) const{
+		features f;
+		extract(s, f);
+		return state_value(f);
+	}
+	/**
+	 * (add) the values of n boards, the same as state_value() of each, but 4 boards at a time by AVX2 gathers
+	 * if the CPU supports it, then the entries of a feature for the 4 boards are fetched by one gather
+	 * the indices of the legacy network are extracted by shifts and masks of the 4 boards in a register,
+	 * those of other networks by extract()
+	 */
+	void state_values(const board* s, size_t n, float* V) const {
+		size_t i = 0;
+		if (simd) for (; i + 4 <= n; i += 4) gather_values(s + i, V + i);
+		for (; i < n; i++) V[i] = state_value(s[i]);
+	}
 	// for after state , we only give the evaluation instead of (state,reward) pair
 	float update(const board& s, const board& s_after, float reward, bool end){
 		// note that terminal state with target 0 : end TRUE -> term
-		float delta = reward + ((end)? (0) : (state_value(s_after))) - state_value(s);
-		float V=0; float rate = alpha/8.0;
-		//std::cout << "----------------------------------------------------" <<std::endl;
-		//std::cout << "delta : " << delta <<std::endl;
-		//std::cout << "before : " << net[0][decode(s,0,1,2,3)] <<std::endl;
-		//std::cout << "step: " << rate*delta <<std::endl;
-		(net[0][decode(s,0,1,2,3)] += rate*delta);
-		(net[1][decode(s,4,5,6,7)] += rate*delta);
-		(net[2][decode(s,8,9,10,11)] += rate*delta);
-		(net[3][decode(s,12,13,14,15)] += rate*delta);
-		(net[4][decode(s,0,4,8,12)] += rate*delta);
-		(net[5][decode(s,1,5,9,13)] += rate*delta);
-		(net[6][decode(s,2,6,10,14)] += rate*delta);
-		(net[7][decode(s,3,7,11,15)] += rate*delta);
-		//std::cout << "after : " << net[0][decode(s,0,1,2,3)] <<std::endl;
-		//std::cout << "----------------------------------------------------" <<std::endl;
-		return V; 	// return updated state value
+		features f;
+		extract(s, f);
+		return update(f.data(), reward + ((end)? (0) : (state_value(s_after))));
+	}
+	/**
+	 * (add) prefetch the entries of a state, given by its feature indices, for an update soon after
+	 */
+	void prefetch(const uint32_t* idx) const {
+		for (size_t t = 0; t < tuples.size(); t++) {
+			const weight& w = net[t];
+			for (size_t i = 0; i < tuples[t].isomorphisms(); i++, idx++) {
+				__builtin_prefetch(&w[*idx], 1);
+				if (tc.size()) __builtin_prefetch(&tc[t][*idx], 1);
+			}
+		}
+	}
+	/**
+	 * move the value of a state, given by its feature indices, toward the target
+	 * return the TD error before the update
+	 */
+	float update(const uint32_t* idx, float target){
+		float delta = target - state_value(idx);
+		float rate = alpha/double(num_features());
+		for (size_t t = 0; t < tuples.size(); t++) {
+			weight& w = net[t];
+			if (tc.size()) {
+				cweight& c = tc[t];
+				for (size_t i = 0; i < tuples[t].isomorphisms(); i++, idx++) {
+					w.accumulate(*idx, rate*c[*idx].rate()*delta);
+					c.accumulate(*idx, { delta, std::abs(delta) });
+				}
+				continue;
+			}
+			for (size_t i = 0; i < tuples[t].isomorphisms(); i++) w.accumulate(*(idx++), rate*delta);
+		}
+		return delta;
 	}
 
-	
+protected:
+	static bool has_avx2() {
+#if defined(__x86_64__)
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+
+#if defined(__x86_64__)
+	/**
+	 * the values of 4 boards, summed in the same order as state_value(), so the results are identical
+	 */
+	__attribute__((target("avx2"))) void gather_values(const board* s, float* V) const {
+		__m128 sum = _mm_setzero_ps();
+		if (legacy) {
+			const __m256i key = _mm256_set1_epi64x(0xffff), nibbles = _mm256_set1_epi64x(0x000f000f000f000full);
+			__m256i b = _mm256_set_epi64x(s[3].raw(), s[2].raw(), s[1].raw(), s[0].raw());
+			for (int i = 0; i < 4; i++) { // board::row
+				__m256i x = _mm256_and_si256(_mm256_srl_epi64(b, _mm_cvtsi32_si128((3 - i) << 4)), key);
+				sum = _mm_add_ps(sum, _mm256_i64gather_ps(&net[i][0], x, 4));
+			}
+			for (int i = 0; i < 4; i++) { // board::col
+				__m256i x = _mm256_and_si256(_mm256_srl_epi64(b, _mm_cvtsi32_si128((3 - i) << 2)), nibbles);
+				x = _mm256_or_si256(_mm256_or_si256(x, _mm256_srli_epi64(x, 12)), _mm256_or_si256(_mm256_srli_epi64(x, 24), _mm256_srli_epi64(x, 36)));
+				x = _mm256_and_si256(x, key);
+				sum = _mm_add_ps(sum, _mm256_i64gather_ps(&net[i + 4][0], x, 4));
+			}
+		} else {
+			features f[4];
+			for (int k = 0; k < 4; k++) extract(s[k], f[k]);
+			const uint32_t* f0 = f[0].data(); const uint32_t* f1 = f[1].data();
+			const uint32_t* f2 = f[2].data(); const uint32_t* f3 = f[3].data();
+			for (size_t t = 0; t < tuples.size(); t++) {
+				const float* w = &net[t][0];
+				for (size_t i = 0; i < tuples[t].isomorphisms(); i++) {
+					__m128i x = _mm_set_epi32(*(f3++), *(f2++), *(f1++), *(f0++));
+					sum = _mm_add_ps(sum, _mm_i32gather_ps(w, x, 4));
+				}
+			}
+		}
+		_mm_storeu_ps(V, sum);
+	}
+#else
+	void gather_values(const board* s, float* V) const {
+		for (int k = 0; k < 4; k++) V[k] = state_value(s[k]);
+	}
+#endif
+
 protected:
 	float alpha;
+	bool legacy;	// the network is exactly the 4 rows and 4 columns, which are extracted directly
+	bool simd;	// evaluate 4 boards at a time by AVX2 gathers, see state_values
+	std::vector<cweight> tc;	// the accumulators of temporal coherence learning, parallel to net
+	std::vector<std::pair<uint64_t, float>> schedule;
+
+	enum { checkpoint_slice = 1 << 20 };	// the entries copied into the snapshot per trained episode
+	uint64_t every;	// the episodes between checkpoints, 0 for none
+	uint64_t keep;
+	std::string prefix;	// the path of the checkpoints, save=... of the origin
+	/**
+	 * the thread writing the last checkpoint and its snapshot of the tables, shared by the copies
+	 */
+	struct checkpointer {
+		std::mutex lock;
+		std::thread writer;
+		std::vector<weight> snapshot;
+		std::atomic<bool> writing;
+		std::atomic<uint64_t> episodes;	// of the checkpoint being copied, 0 for none
+		size_t table, entry;	// the progress of the copying
+		checkpointer() : writing(false), episodes(0), table(0), entry(0) {}
+		~checkpointer() { if (writer.joinable()) writer.join(); }
+	};
+	std::shared_ptr<checkpointer> saver;
+};
+
+/**
+ * the bag of the tiles 1-3 of the environment, bit t for tile t remaining in the bag,
+ * a tile is drawn without replacement, and the bag is refilled once it is empty
+ * (shared by the environment, the player tracking it, and the server, see server.h)
+ */
+struct tile_bag {
+	enum { full = 0b1110 };
+	static unsigned draw(unsigned bag, unsigned tile) {
+		bag &= ~(1u << tile);
+		return bag ? bag : unsigned(full);
+	}
 };
 
 /**
@@ -193,39 +764,42 @@ protected:
 class rndenv : public random_agent {
 public:
 	rndenv(const std::string& args = "") : random_agent("name=random role=environment " + args),
-		space({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }),idx(0) ,bag({1,2,3}) ,popup(0, 2) {}
+		bag(tile_bag::full), rng(meta.find("seed") != meta.end() ? uint64_t(meta["seed"]) : 0) {}
 
 	virtual void close_episode(const std::string& flag = "") {
 		// reset the evil para. for next ep
-		idx = 0;
+		bag = tile_bag::full;
 	}
 
+	/**
+	 * (add) pick an empty cell uniformly from the bitmask of the border opposite to the last slide,
+	 * and a tile uniformly from the rest of the bag, i.e., as shuffling the cells and the bag
+	 */
 	virtual action take_action(const board& after) {
-		std::shuffle(space.begin(), space.end(), engine);
+		// boarder: (0,1,2,3) ,(0,4,8,12) ,(12,13,14,15) ,(3,7,11,15), in the bits of board::empty()
+		static const uint32_t border[4] = { 0x000f, 0x8888, 0xf000, 0x1111 };
+		uint32_t space = after.empty();
 		board::op last = after.get_last_act();	// pass last act
-		for (int pos : space) {
-			if (after(pos) != 0) continue;
+		if (last < 4) space &= border[last];
+		if (space == 0) return action();
 
-			// boarder: (0,1,2,3) ,(0,4,8,12) ,(12,13,14,15) ,(3,7,11,15)
-			if (last == 0 && pos < 12) continue; 
-			if (last == 2 && pos > 3) continue; 
-			if (last == 1 && pos % 4) continue; 
-			if (last == 3 && (pos+1) % 4) continue; 
-			
-			if(idx == 0 ) std::shuffle(bag.begin(), bag.end(), engine);
-			board::cell tile = bag[idx++];
-			idx %= 3;
-
-			return action::place(pos, tile);
-		}
-		return action();
+		unsigned pos = 15 - select(space, rng.below(__builtin_popcount(space)));
+		board::cell tile = select(bag, rng.below(__builtin_popcount(bag)));
+		bag = tile_bag::draw(bag, tile);
+		return action::place(pos, tile);
 	}
 
 private:
-	std::array<int, 16> space;	
-	int idx;					// add
-	std::array<int, 3> bag;		// add
-	std::uniform_int_distribution<int> popup;
+	/**
+	 * the index of the n-th (from 0) lowest set bit
+	 */
+	static unsigned select(uint32_t bits, unsigned n) {
+		while (n--) bits &= bits - 1;
+		return __builtin_ctz(bits);
+	}
+
+	unsigned bag;	// add
+	xoshiro rng;
 };
 
 /**
@@ -242,9 +816,9 @@ public:
 
 	virtual action take_action(const board& before) {
 		std::shuffle(opcode.begin(), opcode.end(), engine);
+		unsigned legal = before.expand().legal;
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
-			if (reward != -1) return action::slide(op);	
+			if (legal & (1u << op)) return action::slide(op);
 			// in origin , we just pick up a valid slide randomly
 		}
 		return action();
@@ -257,56 +831,260 @@ private:
 /**
  * learning player : what we use for player
  *
+ * (add) search=N : N-ply expectimax search over the environment placements, 1 for greedy
+ *       time=T   : time budget per move in milliseconds, deepen iteratively until N or the budget runs out
+ *       cache=M  : transposition table of M megabytes for evaluations and search results,
+ *                  16 by default when searching, none for greedy
+ *       mode=backward : train after the episode ends, backward from the last afterstate (default)
+ *       mode=online   : train during the episode, each afterstate once its window of next steps is known
+ *       lambda=L : the λ-return target, 0 for TD(0) (default)
+ *       window=H : steps of the truncated λ-return in online mode, 1 by default for TD(0), 5 otherwise
+ *       prefetch=P : when training after the episode, prefetch the entries of the step P steps ahead, 1 by default, 0 for none
  */
 class learning_player : public learning_agent {
 public:
 	learning_player(const std::string& args = "") : learning_agent("name=learning role=player " + args),
-		opcode({ 0, 1, 2, 3 }), round(0) {}
+		opcode({ 0, 1, 2, 3 }), round(0), path(num_features()), online(false), lambda(0), window(1), ahead(1), depth(1), budget(0), bag(tile_bag::full),
+		table(size_t(meta.count("cache") ? double(meta["cache"]) : (meta.count("search") ? 16 : 0)) << 20) {
+		if (meta.find("search") != meta.end())
+			depth = std::max(int(meta["search"]), 1);
+		if (meta.find("time") != meta.end())
+			budget = std::chrono::milliseconds(int(meta["time"]));
+		if (meta.find("mode") != meta.end())
+			online = (property("mode") == "online");
+		if (meta.find("lambda") != meta.end())
+			lambda = float(meta["lambda"]);
+		window = (lambda != 0) ? 5 : 1;
+		if (meta.find("window") != meta.end())
+			window = std::max(int(meta["window"]), 1);
+		if (meta.find("prefetch") != meta.end())
+			ahead = int(meta["prefetch"]);
+	}
+	virtual ~learning_player() {
+		if (table.enabled()) std::cerr << name() << ": " << table << std::endl;
+	}
 
 	// consider all possible action, evaluate after state value with reward
 	// select the action with largest evaluation, should be careful the terminaal state   
 	// evil state space :
 	virtual action take_action(const board& before) {
-		int best_op = -1; float best_eval = -9999999.0; 
-		board after; board::reward reward;
+		observe(before);
+		int best_op = -1; float best_eval = -9999999.0;
+		board best_after = board(before); board::reward best_reward = -1; // the terminal state if no legal action
+		board::moves moves = before.expand();
+		float values[4] = { 0, 0, 0, 0 };
+		if (depth == 1) evaluate(moves, values);
 	 	
 		for (int op : opcode) {
-			after = board(before);
-			reward = after.slide(op);
+			if (!(moves.legal & (1u << op))) continue;	// not valid action
+			const board& after = moves.after[op];
+			board::reward reward = moves.score[op];
 			// now we have s = before, s'=after, r = reward
-			if (reward == -1) continue;	// not valid action
-			// float eval = static_cast<float>(reward) + state_value(after);
-			float eval = reward + state_value(after);
-			if(best_eval <= eval) {best_op = op; best_eval = eval;}
+			float value = values[op];
+			float eval = reward + value;
+			if(best_eval <= eval) {best_op = op; best_eval = eval; best_after = after; best_reward = reward;}
 		}	
+		if (depth > 1 && best_op != -1) {
+			best_op = deepen(before);
+			best_after = moves.after[best_op];
+			best_reward = moves.score[best_op];
+		}
 
-		after = board(before);
-		reward = after.slide(best_op);
-		state.emplace_back(board(after));
-		rh.emplace_back(reward);
+		s_before = best_after;
+		if (learning()) {
+			// the feature indices are extracted once here, and reused by the training
+			path.push(best_reward);
+			uint32_t* idx = path.index(path.size() - 1);
+			features f;
+			extract(best_after, f);
+			std::copy(f.begin(), f.begin() + num_features(), idx);
+			if (online && path.size() > window) {
+				update(path.index(0), lambda_return(0));
+				path.erase_front(1);
+				table.clear();	// cached values are stale after training
+			}
+		}
 
 		return (best_op != -1) ? action::slide(best_op) : action();
 		//return action();
 	}
 
 	virtual void close_episode(const std::string& flag = "") {
-    	// train the n-tuple network by TD(0)
-   		update(state[state.size()-1],board(),rh[state.size()-1],true);
-    	for(int i = state.size() - 2; i >= 0; i--){
-        	update(state[i],state[i+1],rh[i],false);
-    	}	
+    	// train the n-tuple network, see mode=... and lambda=...
+		if (!learning() || path.empty()) return;
+		if (online) {
+			// the rest of the episode, whose returns end at the terminal state
+			for (size_t i = 0; i < path.size(); i++) {
+				if (ahead && i + ahead < path.size()) prefetch(path.index(i + ahead));
+				update(path.index(i), lambda_return(i));
+			}
+		} else {
+			// backward, from the stored feature indices, the target takes the value of the next afterstate after its update
+			// and the λ-return of the next afterstate, which is complete since it is computed backward
+			float next = 0, G = 0;	// the terminal state
+			for (size_t i = path.size(); i-- > 0; ) {
+				const uint32_t* idx = path.index(i);
+				if (ahead && i >= ahead) prefetch(path.index(i - ahead));	// fetched while the steps in between are updated
+				G = path.reward(i) + (1 - lambda) * next + lambda * G;
+				update(idx, G);
+				next = state_value(idx);
+			}
+		}
+		count_episode();
+		table.clear();	// cached values are stale after training
 	}
 	
 	virtual void open_episode(const std::string& flag = "") {
-    	state.clear();
-		rh.clear();
+		path.clear();
+		s_before = board();
+		bag = tile_bag::full;
+	}
+
+	// the depth of the expectimax search, 1 for the greedy choice by the afterstate values
+	int search_depth() const { return depth; }
+	// the tiles remaining in the bag of the environment (bit t for tile t) for the next search, e.g., as known by a client
+	void assume_bag(unsigned remaining) { bag = remaining ? remaining : unsigned(tile_bag::full); }
+
+protected:
+	/**
+	 * track the bag of the environment by the tile placed after the last move
+	 * the first move sees 9 initial tiles, i.e., 3 complete bags
+	 */
+	void observe(const board& before) {
+		if (s_before == board()) return;
+		for (int pos = 0; pos < 16; pos++) {
+			if (s_before(pos) || !before(pos)) continue;
+			bag = tile_bag::draw(bag, before(pos));
+			break;
+		}
 	}
 
+	/**
+	 * state value of an afterstate, through the cache if there is one
+	 */
+	float evaluate(const board& after) {
+		if (!table.enabled()) return state_value(after);
+		uint64_t key = cache::hash(after.raw());
+		const cache::entry* e = table.find(key);
+		if (e) return e->value;
+		float value = state_value(after);
+		table.store(key, value);
+		return value;
+	}
+	/**
+	 * state values of the legal afterstates, all four together (see state_values) if there is no cache
+	 */
+	void evaluate(const board::moves& moves, float* values) {
+		if (table.enabled()) {
+			for (int op = 0; op < 4; op++)
+				if (moves.legal & (1u << op)) values[op] = evaluate(moves.after[op]);
+			return;
+		}
+		state_values(moves.after, 4, values);
+	}
+
+	/**
+	 * the λ-return of step i in the trajectory, truncated after the window by the value of step i + window
+	 * or complete if the episode ends earlier, with the target r(j) + V(j + 1) of TD(0) for each step j
+	 */
+	float lambda_return(size_t i) {
+		size_t end = std::min(i + window, path.size());
+		float next = (end < path.size()) ? state_value(path.index(end)) : 0;
+		float G = next;
+		for (size_t j = end; j-- > i; ) {
+			G = path.reward(j) + (1 - lambda) * next + lambda * G;
+			if (j > i) next = state_value(path.index(j));
+		}
+		return G;
+	}
+
+	/**
+	 * iterative deepening expectimax, return the best opcode of the deepest completed search
+	 */
+	int deepen(const board& before) {
+		deadline = std::chrono::steady_clock::now() + budget;
+		nodes = 0;
+		int best_op = -1;
+		// the root result (with the best move) is cached, inner max nodes are cheaper to search again
+		uint64_t key = cache::hash(before.raw(), bag);
+		for (int d = (budget.count() ? 1 : depth); d <= depth; d++) {
+			const cache::entry* e = table.find(key, d);
+			if (e) {
+				best_op = e->move;
+				continue;
+			}
+			timeout = false;
+			result best = search_max(before, bag, d);
+			if (timeout) break;
+			table.store(key, best.value, d, best.move);
+			best_op = best.move;
+		}
+		return best_op;
+	}
+
+	struct result {
+		float value;
+		int move;
+	};
+
+	result search_max(const board& before, unsigned bag, int d) {
+		result best = { 0, -1 }; // 0 for the terminal state
+		board::moves moves = before.expand();
+		for (int op : opcode) {
+			if (!(moves.legal & (1u << op))) continue;
+			float eval = moves.score[op] + search_chance(moves.after[op], bag, d - 1);
+			if (best.move == -1 || best.value <= eval) best = { eval, op };
+		}
+		return best;
+	}
+
+	/**
+	 * the expectation over all tiles in the bag placed to all empty cells
+	 * on the border opposite to the last slide
+	 */
+	float search_chance(const board& after, unsigned bag, int d) {
+		if (d == 0) return state_value(after);
+		if (timeout || ((++nodes & 0x3ff) == 0 && std::chrono::steady_clock::now() > deadline && budget.count())) {
+			timeout = true;
+			return 0;
+		}
+
+		uint64_t key = cache::hash(after.raw(), bag | ((after.get_last_act() & 0b11) << 4) | 0x40); // 0x40 for chance nodes
+		const cache::entry* e = table.find(key, d);
+		if (e) return e->value;
+
+		static const int border[4][4] = { {12, 13, 14, 15}, {0, 4, 8, 12}, {0, 1, 2, 3}, {3, 7, 11, 15} };
+		float sum = 0; int num = 0;
+		for (int pos : border[after.get_last_act() & 0b11]) {
+			if (after(pos)) continue;
+			for (board::cell tile = 1; tile <= 3; tile++) {
+				if (!(bag & (1u << tile))) continue;
+				board before = board(after);
+				before.place(pos, tile);
+				sum += search_max(before, tile_bag::draw(bag, tile), d).value;
+				num++;
+			}
+		}
+		float value = num ? sum / num : 0;
+		if (!timeout) table.store(key, value, d);
+		return value;
+	}
 
 private:
 	std::array<int, 4> opcode;
 	board s_before;	// player space : last state log
 	unsigned round;
-	std::vector<board> state;
-	std::vector<float> rh;
+	trajectory path;	// the afterstates of this episode for training
+	bool online;
+	float lambda;
+	size_t window;
+	size_t ahead;	// the steps of prefetching in the training after the episode, 0 for none
+
+	int depth;
+	std::chrono::milliseconds budget;
+	std::chrono::steady_clock::time_point deadline;
+	bool timeout;
+	size_t nodes;
+	unsigned bag;
+	cache table;
 };
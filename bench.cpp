@@ -0,0 +1,399 @@
+/**
+ * Micro-benchmarks for the Threes agent
+ * use 'make bench' to compile the source, then run './bench'
+ *
+ * To specify the number of sampled boards and the rounds over them
+ * $ ./bench --boards=100000 --rounds=100
+ *
+ * To benchmark with trained weights instead of zero weights
+ * $ ./bench --play="load=weights.bin"
+ *
+ * To benchmark another network, e.g., the 6-tuple axe and rectangle patterns
+ * $ ./bench --play="tuple=axe,rect"
+ *
+ * To count the heap allocations per game, and the games per second, over more games
+ * $ ./bench --games=1000
+ *
+ * To run some of the suites (slide, value, update, env, game, alloc, memory), all of them by default
+ * $ ./bench --suite=slide,value
+ *
+ * To print the results as CSV or JSON (suite, name, value, unit) for comparing builds, see 'make benchmark'
+ * $ ./bench --format=csv > bench.csv
+ *
+ * all the boards and the games are of fixed seeds, so the checksums should match between builds
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <fstream>
+#include <sstream>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistic.h"
+
+/**
+ * count all heap allocations of the program
+ */
+size_t allocations = 0;
+__attribute__((noinline)) void* operator new(size_t size) {
+	allocations++;
+	if (void* p = std::malloc(size)) return p;
+	throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+
+/**
+ * learning agent with access to its tables, for comparing evaluation paths
+ */
+class bench_agent : public learning_agent {
+public:
+	bench_agent(const std::string& args = "") : learning_agent(args) {
+		if (net.empty() && qnet.empty()) init_weights("");
+	}
+
+	bool is_legacy() const { return legacy; }
+
+	// evaluate by decoding each tuple separately (legacy network only)
+	float decode_value(const board& s) const {
+		float V = 0;
+		V += net[0][decode(s,0,1,2,3)];
+		V += net[1][decode(s,4,5,6,7)];
+		V += net[2][decode(s,8,9,10,11)];
+		V += net[3][decode(s,12,13,14,15)];
+		V += net[4][decode(s,0,4,8,12)];
+		V += net[5][decode(s,1,5,9,13)];
+		V += net[6][decode(s,2,6,10,14)];
+		V += net[7][decode(s,3,7,11,15)];
+		return V;
+	}
+};
+
+/**
+ * collect the boards of some fixed-seed games between the dummy player and the environment
+ */
+std::vector<board> sample_boards(size_t count, unsigned seed) {
+	std::vector<board> boards;
+	boards.reserve(count);
+	player play("seed=" + std::to_string(seed));
+	rndenv evil("seed=" + std::to_string(seed + 1));
+	while (boards.size() < count) {
+		episode game;
+		while (boards.size() < count) {
+			agent& who = game.take_turns(play, evil);
+			action move = who.take_action(game.state());
+			if (game.apply_action(move) != true) break;
+			boards.push_back(game.state());
+		}
+	}
+	return boards;
+}
+
+/**
+ * the results of the suites, printed as they come in the text format,
+ * or all at the end in CSV or JSON, one record of (suite, name, value, unit) per result
+ */
+class report {
+public:
+	report(const std::string& format = "text") : format(format) {}
+
+	void add(const std::string& suite, const std::string& name, double value, const std::string& unit) {
+		results.push_back({ suite, name, value, unit });
+		if (format != "text") return;
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::left << std::setw(32) << name << std::right << std::fixed;
+		std::cout << std::setprecision(value < 100 ? 4 : 0) << value << " " << unit << std::endl;
+		std::cout.copyfmt(ff);
+	}
+
+	void flush() const {
+		std::ostringstream out;
+		out << std::setprecision(10);
+		if (format == "csv") {
+			out << "suite,name,value,unit" << std::endl;
+			for (const result& r : results)
+				out << r.suite << ',' << r.name << ',' << r.value << ',' << r.unit << std::endl;
+		} else if (format == "json") {
+			out << "[" << std::endl;
+			for (size_t i = 0; i < results.size(); i++) {
+				const result& r = results[i];
+				out << "  {\"suite\": \"" << r.suite << "\", \"name\": \"" << r.name << "\", ";
+				out << "\"value\": " << r.value << ", \"unit\": \"" << r.unit << "\"}";
+				out << (i + 1 < results.size() ? "," : "") << std::endl;
+			}
+			out << "]" << std::endl;
+		}
+		std::cout << out.str();
+	}
+
+private:
+	struct result {
+		std::string suite, name;
+		double value;
+		std::string unit;
+	};
+	std::string format;
+	std::vector<result> results;
+};
+
+/**
+ * run an operation over all the boards for some rounds, report the operations per second and the checksum of the results
+ */
+template<typename operation>
+void measure(report& rep, const std::string& suite, const std::string& name, const std::vector<board>& boards, size_t rounds, operation op) {
+	auto start = std::chrono::steady_clock::now();
+	double sink = 0;
+	for (size_t n = 0; n < rounds; n++)
+		for (const board& b : boards) sink += op(b);
+	auto stop = std::chrono::steady_clock::now();
+	double sec = std::chrono::duration<double>(stop - start).count();
+	rep.add(suite, name, boards.size() * rounds / sec, "ops/s");
+	rep.add(suite, name + "/checksum", sink, "sum");
+}
+
+/**
+ * as measure() of state_value, but by state_values() of 4 boards at a time
+ */
+void measure_batch(report& rep, const std::string& suite, const std::string& name, const std::vector<board>& boards, size_t rounds, const learning_agent& agent) {
+	auto start = std::chrono::steady_clock::now();
+	double sink = 0;
+	float V[4];
+	for (size_t n = 0; n < rounds; n++) {
+		for (size_t i = 0; i + 4 <= boards.size(); i += 4) {
+			agent.state_values(&boards[i], 4, V);
+			sink += V[0] + V[1] + V[2] + V[3];
+		}
+	}
+	auto stop = std::chrono::steady_clock::now();
+	double sec = std::chrono::duration<double>(stop - start).count();
+	rep.add(suite, name, (boards.size() / 4 * 4) * rounds / sec, "ops/s");
+	rep.add(suite, name + "/checksum", sink, "sum");
+}
+
+/**
+ * the backward training of learning_player::close_episode, over the boards as one trajectory,
+ * with the entries of the step some steps ahead prefetched (see learning_agent::prefetch), 0 for none
+ */
+void measure_backward(report& rep, const std::string& name, const std::vector<board>& boards, size_t rounds, learning_agent& agent, size_t ahead) {
+	size_t n = agent.num_features();
+	std::vector<uint32_t> index(boards.size() * n);
+	learning_agent::features f;
+	for (size_t i = 0; i < boards.size(); i++) {
+		agent.extract(boards[i], f);
+		std::copy(f.begin(), f.begin() + n, index.begin() + i * n);
+	}
+	auto start = std::chrono::steady_clock::now();
+	double sink = 0;
+	for (size_t r = 0; r < rounds; r++) {
+		float next = 0;
+		for (size_t i = boards.size(); i-- > 0; ) {
+			const uint32_t* idx = &index[i * n];
+			if (ahead && i >= ahead) agent.prefetch(&index[(i - ahead) * n]);
+			sink += agent.update(idx, 1 + next);
+			next = agent.state_value(idx);
+		}
+	}
+	auto stop = std::chrono::steady_clock::now();
+	double sec = std::chrono::duration<double>(stop - start).count();
+	rep.add("update", name, boards.size() * rounds / sec, "ops/s");
+	rep.add("update", name + "/checksum", sink, "sum");
+}
+
+/**
+ * the kB of the anonymous memory of this process in transparent huge pages
+ */
+size_t huge_pages() {
+	std::ifstream in("/proc/self/smaps_rollup");
+	for (std::string key; in >> key; in.ignore(256, '\n')) {
+		size_t kb;
+		if (key == "AnonHugePages:" && in >> kb) return kb;
+	}
+	return 0;
+}
+
+/**
+ * evaluate and train with the tables in the memory of a page option (see memory_policy),
+ * the difference between the page sizes is the cost of the TLB misses, which cannot be counted here
+ */
+void measure_memory(report& rep, const std::string& pages, const std::string& name, const std::vector<board>& boards, size_t rounds, const std::string& play_args) {
+	size_t before = huge_pages();
+	bench_agent agent(play_args + " pages=" + pages);
+	rep.add("memory", name + "/huge", huge_pages() - before, "kB");
+	measure(rep, "memory", name + "/state_value", boards, rounds, [&](const board& b) { return agent.state_value(b); });
+	learning_agent::features f;
+	measure(rep, "memory", name + "/update", boards, rounds, [&](const board& b) { agent.extract(b, f); return agent.update(f.data(), 100); });
+}
+
+/**
+ * play fixed-seed games between the learning player and the environment, report the games and the moves per second
+ */
+void measure_games(report& rep, const std::string& name, const std::string& play_args, size_t games) {
+	learning_player play(play_args);
+	rndenv evil("seed=1");
+	episode game;
+	size_t moves = 0;
+	uint64_t score = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t n = 0; n < games; n++) {
+		play.open_episode("~:" + evil.name());
+		evil.open_episode(play.name() + ":~");
+		game.clear();
+		game.open_episode(play.name() + ":" + evil.name());
+		while (true) {
+			agent& who = game.take_turns(play, evil);
+			action move = who.take_action(game.state());
+			if (game.apply_action(move) != true) break;
+		}
+		game.close_episode(evil.name());
+		play.close_episode(evil.name());
+		evil.close_episode(evil.name());
+		moves += game.step();
+		score += game.score();
+	}
+	auto stop = std::chrono::steady_clock::now();
+	double sec = std::chrono::duration<double>(stop - start).count();
+	rep.add("game", name, games / sec, "games/s");
+	rep.add("game", name + "/moves", moves / sec, "moves/s");
+	rep.add("game", name + "/checksum", score, "sum");
+}
+
+/**
+ * the heap allocations per game of playing, training, and recording the episodes,
+ * counted over the second half of the games, i.e., after the statistic reaches its limit
+ */
+void measure_allocations(report& rep, const std::string& name, const std::string& play_args, size_t games, bool streaming) {
+	learning_player play("init " + play_args);
+	rndenv evil("seed=1");
+	statistic stat(games * 2, -1, std::max(games / 4, size_t(1)));
+	std::ofstream sink;
+	if (streaming) {
+		sink.open("/dev/null", std::ios::out | std::ios::binary);
+		stat.stream(sink, true);
+	}
+	size_t start = 0;
+	while (!stat.is_finished()) {
+		if (stat.size() == games) start = allocations;
+		play.open_episode("~:" + evil.name());
+		evil.open_episode(play.name() + ":~");
+		stat.open_episode(play.name() + ":" + evil.name());
+		episode& game = stat.back();
+		while (true) {
+			agent& who = game.take_turns(play, evil);
+			action move = who.take_action(game.state());
+			if (game.apply_action(move) != true) break;
+		}
+		stat.close_episode(evil.name());
+		play.close_episode(evil.name());
+		evil.close_episode(evil.name());
+	}
+	stat.close_stream();
+	rep.add("alloc", name, double(allocations - start) / games, "allocs/game");
+}
+
+int main(int argc, const char* argv[]) {
+	size_t count = 100000, rounds = 100, games = 200;
+	std::string play_args, suites = "slide,value,update,env,game,alloc,memory", format = "text";
+	for (int i = 1; i < argc; i++) {
+		std::string para(argv[i]);
+		if (para.find("--boards=") == 0) {
+			count = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--rounds=") == 0) {
+			rounds = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--games=") == 0) {
+			games = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--play=") == 0) {
+			play_args = para.substr(para.find("=") + 1);
+		} else if (para.find("--suite=") == 0) {
+			suites = para.substr(para.find("=") + 1);
+		} else if (para.find("--format=") == 0) {
+			format = para.substr(para.find("=") + 1);
+		}
+	}
+	auto enabled = [&](const std::string& suite) { return ("," + suites + ",").find("," + suite + ",") != std::string::npos; };
+
+	report rep(format);
+	bench_agent agent(play_args);
+	std::vector<board> boards = sample_boards(count, 0);
+
+	if (enabled("slide")) {
+		const char* name[] = { "slide/up", "slide/right", "slide/down", "slide/left" };
+		for (unsigned op = 0; op < 4; op++)
+			measure(rep, "slide", name[op], boards, rounds, [=](const board& b) { return board(b).slide(op); });
+		// all four afterstates at once, by the move generator
+		measure(rep, "slide", "expand", boards, rounds, [](const board& b) { board::moves m = b.expand(); return m.score[0] + m.score[1] + m.score[2] + m.score[3] + int(m.legal); });
+		measure(rep, "slide", "slide/all", boards, rounds, [](const board& b) {
+			return board(b).slide(0) + board(b).slide(1) + board(b).slide(2) + board(b).slide(3);
+		});
+	}
+
+	if (enabled("value")) {
+		learning_agent::features f;
+		measure(rep, "value", "extract", boards, rounds, [&](const board& b) { agent.extract(b, f); return f[0]; });
+		if (agent.is_legacy())
+			measure(rep, "value", "decode", boards, rounds, [&](const board& b) { return agent.decode_value(b); });
+		measure(rep, "value", "state_value", boards, rounds, [&](const board& b) { return agent.state_value(b); });
+		// 4 boards at a time, as the afterstates of a move (see learning_agent::state_values)
+		measure_batch(rep, "value", "state_values", boards, rounds, agent);
+		bench_agent scalar(play_args + " simd=0");
+		measure_batch(rep, "value", "state_values/scalar", boards, rounds, scalar);
+
+		// the int16 quantized network, and its error against the float network
+		bench_agent quant(play_args + " alpha=0 quantize=int16");
+		measure(rep, "value", "state_value/q16", boards, rounds, [&](const board& b) { return quant.state_value(b); });
+		double sum = 0, max = 0;
+		for (const board& b : boards) {
+			double err = std::abs(agent.state_value(b) - quant.state_value(b));
+			sum += err;
+			max = std::max(max, err);
+		}
+		rep.add("value", "error/q16", sum / boards.size(), "avg");
+		rep.add("value", "error/q16/max", max, "max");
+	}
+
+	if (enabled("update")) {
+		// a network of its own, since the updates change the weights
+		bench_agent learn(play_args + " alpha=0.1");
+		learning_agent::features f;
+		measure(rep, "update", "update", boards, rounds, [&](const board& b) { learn.extract(b, f); return learn.update(f.data(), 100); });
+		for (size_t ahead : { 0, 1, 2, 4, 8 }) {
+			bench_agent backward(play_args + " alpha=0.1");
+			measure_backward(rep, "backward/prefetch=" + std::to_string(ahead), boards, rounds / 10 + 1, backward, ahead);
+		}
+	}
+
+	if (enabled("env")) {
+		rndenv evil("seed=1");
+		measure(rep, "env", "rndenv", boards, rounds, [&](const board& b) { return unsigned(evil.take_action(b)) & 0xff; });
+	}
+
+	if (enabled("game")) {
+		measure_games(rep, "infer", "init " + play_args + " alpha=0", games);
+		measure_games(rep, "train", "init " + play_args + " alpha=0.1", games);
+	}
+
+	if (enabled("alloc")) {
+		measure_allocations(rep, "alloc/limit", play_args, games, false);
+		measure_allocations(rep, "alloc/stream", play_args, games, true);
+	}
+
+	if (enabled("memory")) {
+		// the boards in random order, as the lookups of many games at once
+		std::vector<board> shuffled(boards);
+		std::shuffle(shuffled.begin(), shuffled.end(), xoshiro(1));
+		// each policy runs twice, interleaved against the drift of the machine, and the second run is named pages#2
+		for (int run = 1; run <= 2; run++)
+			for (std::string pages : { "small", "thp" })
+				measure_memory(rep, pages, run == 1 ? pages : pages + "#2", shuffled, rounds, play_args);
+	}
+
+	rep.flush();
+	return 0;
+}
@@ -4,7 +4,7 @@
 #include <iomanip>
 
 /**
- * array-based board for 2048
+ * bitboard for threes, 4 bits (the tile index) per cell
  *
  * index (1-d form):
  *  (0)  (1)  (2)  (3)
@@ -12,29 +12,57 @@
  *  (8)  (9) (10) (11)
  * (12) (13) (14) (15)
  *
+ * (comment add) : the board is read as a 64-bit hexadecimal number,
+ * cell (0) is the most significant nibble and cell (15) is the least one.
+ * tile index -> tile value : 0, 1, 2, 3, 6, 12, 24, ..., 6144, 12288
  */
 class board {
 public:
 	typedef uint32_t cell;
-	typedef std::array<cell, 4> row;
-	typedef std::array<row, 4> grid;
 	typedef uint64_t data;
 	typedef int reward;	
 	typedef unsigned op; //add for sliding rule
 
 public:
-	board() : tile(), attr(0), last_act(5), round(0) {}
-	board(const grid& b, data v = 0) : tile(b), attr(v) {}
+	board(data raw = 0, data v = 0) : tile(raw), attr(v), last_act(5), round(0) {}
 	board(const board& b) = default;
 	board& operator =(const board& b) = default;
-	
 
-	operator grid&() { return tile; }
-	operator const grid&() const { return tile; }
-	row& operator [](unsigned i) { return tile[i]; }
-	const row& operator [](unsigned i) const { return tile[i]; }
-	cell& operator ()(unsigned i) { return tile[i / 4][i % 4]; }
-	const cell& operator ()(unsigned i) const { return tile[i / 4][i % 4]; }
+	data raw() const { return tile; }
+	cell operator ()(unsigned i) const { return (tile >> ((15 - i) << 2)) & 0x0f; }
+	void set(unsigned i, cell t) { tile = (tile & ~(data(0x0f) << ((15 - i) << 2))) | (data(t & 0x0f) << ((15 - i) << 2)); }
+
+	/**
+	 * fetch/place a row (or a column) as a 16-bit key, the first cell is the most significant nibble
+	 */
+	cell row(unsigned r) const { return (tile >> ((3 - r) << 4)) & 0xffff; }
+	cell col(unsigned c) const {
+		data x = (tile >> ((3 - c) << 2)) & 0x000f000f000f000full;
+		return (x | (x >> 12) | (x >> 24) | (x >> 36)) & 0xffff;
+	}
+	static data spread_row(cell k, unsigned r) { return data(k) << ((3 - r) << 4); }
+	static data spread_col(cell k, unsigned c) {
+		data x = data(k & 0x000f) | (data(k & 0x00f0) << 12) | (data(k & 0x0f00) << 24) | (data(k & 0xf000) << 36);
+		return x << ((3 - c) << 2);
+	}
+
+	/**
+	 * (add) the bitmask of the empty cells, bit (15 - i) is set if cell i is empty,
+	 * i.e., the bits are in the same order as the nibbles
+	 */
+	uint32_t empty() const {
+		data x = tile | (tile >> 1);
+		x = ~(x | (x >> 2)) & 0x1111111111111111ull;
+		x = (x | (x >> 3)) & 0x0303030303030303ull;
+		x = (x | (x >> 6)) & 0x000f000f000f000full;
+		x = (x | (x >> 12)) & 0x000000ff000000ffull;
+		return uint32_t(x | (x >> 24)) & 0xffff;
+	}
+
+	/**
+	 * the tile value of a tile index
+	 */
+	static cell value(cell t) { return (t < 3) ? t : (3u << (t - 3)); }
 
 	data info() const { return attr; }
 	data info(data dat) { data old = attr; attr = dat; return old; }
@@ -60,7 +88,7 @@ public:
 		if (pos >= 16) return -1;
 		// add tile 3 here
 		if (tile != 1 && tile != 2 && tile != 3) return -1;
-		operator()(pos) = tile;
+		set(pos, tile);
 		return 0;
 	}
 
@@ -73,9 +101,6 @@ public:
 
 		last_act = opcode & 0b11;	// set action record
 		round++;
-		//std::cout << "----------------------------------------------------" <<std::endl;
-		//std::cout << round <<std::endl;
-		//std::cout << "----------------------------------------------------" <<std::endl;
 		switch (opcode & 0b11) {
 		case 0: return slide_up();
 		case 1: return slide_right();
@@ -97,84 +122,83 @@ public:
 	 *   1. for rows ,no double merge occur ,only the left pair merge
 	 *   2. if first tile empty(for row) ,then no merge ,all tiles shift left 1
 	 *   3. if a merge occur ,shift left 1 for later tiles
+	 *
+	 *   (comment add) : the rules are applied once per 16-bit row in lookup,
+	 *   a slide is then 4 table lookups without rotating the board
 	 */
-	
-
-	// test slide_left for threes
-	// for rows, holding itself if no move,holding zero if move 
 
 	reward slide_left() {
-		board prev = *this;
-		reward score = 0;	// +1 if eliminate tiles
+		data move = 0, prev = tile;
+		reward score = 0;
 		for (int r = 0; r < 4; r++) {
-			auto& row = tile[r];	// pick up row
-			int hold = row[0];	// we hold the left at first
-			for (int c = 1; c < 4; c++) {
-				int tile = row[c];				
-				//row[c] = 0;		// in here we do not reset tile
-				if (hold) {
-					// holding the same tile -> merge ->move to prev index
-					if (tile > 2 && tile == hold) {		// 3n case
-						row[c-1] = tile+hold;
-						score += (tile+hold);	// ?
-						hold = 0;
-					} else if ((tile+hold==3) && tile<3) {	// 1+2 case
-						row[c-1] = tile+hold;
-						score += (tile+hold);	// ?
-						hold = 0;
-					} else {
-					// not the same ,change hold to this
-						hold = tile;
-					}
-				} else {
-					row[c-1]=tile;	// if holding zero , then prev vacant -> move
-					// hold = 0;  // already zero
-				}
-			}
-			row[3] = hold;	// always put back
+			const lookup& rule = lookup::find(row(r));
+			move |= spread_row(rule.left, r);
+			score += rule.score_left;
 		}
-		return (*this != prev) ? score : -1;
+		tile = move;
+		return (move != prev) ? score : -1;
 	}
 
 	reward slide_right() {
-		reflect_horizontal();
-		reward score = slide_left();
-		reflect_horizontal();
-		return score;
+		data move = 0, prev = tile;
+		reward score = 0;
+		for (int r = 0; r < 4; r++) {
+			const lookup& rule = lookup::find(row(r));
+			move |= spread_row(rule.right, r);
+			score += rule.score_right;
+		}
+		tile = move;
+		return (move != prev) ? score : -1;
 	}
+
 	reward slide_up() {
-		rotate_right();
-		reward score = slide_right();
-		rotate_left();
-		return score;
+		data move = 0, prev = tile;
+		reward score = 0;
+		for (int c = 0; c < 4; c++) {
+			const lookup& rule = lookup::find(col(c));
+			move |= spread_col(rule.left, c);
+			score += rule.score_left;
+		}
+		tile = move;
+		return (move != prev) ? score : -1;
 	}
+
 	reward slide_down() {
-		rotate_right();
-		reward score = slide_left();
-		rotate_left();
-		return score;
+		data move = 0, prev = tile;
+		reward score = 0;
+		for (int c = 0; c < 4; c++) {
+			const lookup& rule = lookup::find(col(c));
+			move |= spread_col(rule.right, c);
+			score += rule.score_right;
+		}
+		tile = move;
+		return (move != prev) ? score : -1;
 	}
 
+	/**
+	 * (add) generate the moves in one pass, each row and each column is looked up once for both directions,
+	 * the afterstates are as slide(op) would leave them
+	 */
+	struct moves; // see below
+	moves expand() const;
+
 	void transpose() {
-		for (int r = 0; r < 4; r++) {
-			for (int c = r + 1; c < 4; c++) {
-				std::swap(tile[r][c], tile[c][r]);
-			}
-		}
+		data x = tile;
+		x = (x & 0xf0f00f0ff0f00f0full) | ((x & 0x0000f0f00000f0f0ull) << 12) | ((x & 0x0f0f00000f0f0000ull) >> 12);
+		x = (x & 0xff00ff0000ff00ffull) | ((x & 0x00ff00ff00000000ull) >> 24) | ((x & 0x00000000ff00ff00ull) << 24);
+		tile = x;
 	}
 
 	void reflect_horizontal() {
-		for (int r = 0; r < 4; r++) {
-			std::swap(tile[r][0], tile[r][3]);
-			std::swap(tile[r][1], tile[r][2]);
-		}
+		data x = tile;
+		tile = ((x & 0x000f000f000f000full) << 12) | ((x & 0x00f000f000f000f0ull) << 4)
+		     | ((x & 0x0f000f000f000f00ull) >> 4) | ((x & 0xf000f000f000f000ull) >> 12);
 	}
 
 	void reflect_vertical() {
-		for (int c = 0; c < 4; c++) {
-			std::swap(tile[0][c], tile[3][c]);
-			std::swap(tile[1][c], tile[2][c]);
-		}
+		data x = tile;
+		tile = ((x & 0x000000000000ffffull) << 48) | ((x & 0x00000000ffff0000ull) << 16)
+		     | ((x & 0x0000ffff00000000ull) >> 16) | ((x & 0xffff000000000000ull) >> 48);
 	}
 
 	/**
@@ -197,9 +221,9 @@ public:
 public:
 	friend std::ostream& operator <<(std::ostream& out, const board& b) {
 		out << "+------------------------+" << std::endl;
-		for (auto& row : b.tile) {
+		for (int r = 0; r < 4; r++) {
 			out << "|" << std::dec;
-			for (auto t : row) out << std::setw(6) << ((1 << t) & -2u);
+			for (int c = 0; c < 4; c++) out << std::setw(6) << value(b(r * 4 + c));
 			out << "|" << std::endl;
 		}
 		out << "+------------------------+" << std::endl;
@@ -212,9 +236,116 @@ public:
 		return this->last_act;
 	}
 
+public:
+	/**
+	 * the sliding result of a 16-bit row, precomputed for all 65536 rows
+	 * 'left' slides toward the most significant nibble (the first cell)
+	 */
+	class lookup {
+	public:
+		static const lookup& find(cell row) {
+			static const lookup cache[65536];
+			return cache[row];
+		}
+
+		uint16_t left;			// row after sliding left
+		uint16_t right;			// row after sliding right
+		uint16_t score_left : 15;	// reward of sliding left, at most one merge (12288) per row
+		uint16_t move_left : 1;		// whether the row changes by sliding left
+		uint16_t score_right : 15;	// reward of sliding right
+		uint16_t move_right : 1;	// whether the row changes by sliding right
+
+	private:
+		lookup() {
+			static cell row = 0;
+			init(row++);
+		}
+
+		void init(cell row) {
+			std::array<cell, 4> r = { (row >> 12) & 0x0f, (row >> 8) & 0x0f, (row >> 4) & 0x0f, row & 0x0f };
+			score_left = merge(r);
+			left = (r[0] << 12) | (r[1] << 8) | (r[2] << 4) | r[3];
+			move_left = (left != row);
+
+			r = { row & 0x0f, (row >> 4) & 0x0f, (row >> 8) & 0x0f, (row >> 12) & 0x0f };
+			score_right = merge(r);
+			right = (r[3] << 12) | (r[2] << 8) | (r[1] << 4) | r[0];
+			move_right = (right != row);
+		}
+
+		// slide a row to the left by the rules above, return the reward
+		static cell merge(std::array<cell, 4>& row) {
+			cell score = 0;
+			cell hold = row[0];	// we hold the left at first
+			for (int c = 1; c < 4; c++) {
+				cell tile = row[c];
+				if (hold) {
+					if (tile > 2 && tile == hold && tile < 15) {	// 3n case
+						row[c-1] = tile + 1;
+						score += value(tile + 1);
+						hold = 0;
+					} else if ((tile+hold==3) && tile<3) {	// 1+2 case
+						row[c-1] = 3;
+						score += 3;
+						hold = 0;
+					} else {
+						hold = tile;
+					}
+				} else {
+					row[c-1] = tile;	// if holding zero , then prev vacant -> move
+				}
+			}
+			row[3] = hold;	// always put back
+			return score;
+		}
+	};
+
 private:
-	grid tile;
+	data tile;
 	data attr;
 	op last_act;	// add last_act for sliding rule
 	int round;
 };
+
+/**
+ * all afterstates of a board with their rewards, -1 for an illegal opcode,
+ * and the legality bitmask, where bit op is set if slide(op) is legal
+ */
+struct board::moves {
+	board after[4];
+	reward score[4];
+	unsigned legal;
+};
+
+inline board::moves board::expand() const {
+	// the columns are the rows of the transposed board, whose afterstates are transposed back
+	board flip(tile);
+	flip.transpose();
+	data after[4] = { 0, 0, 0, 0 };
+	reward score[4] = { 0, 0, 0, 0 };
+	unsigned legal = 0;
+	for (int i = 0; i < 4; i++) {
+		const lookup& h = lookup::find(row(i));
+		after[3] |= spread_row(h.left, i);
+		after[1] |= spread_row(h.right, i);
+		score[3] += h.score_left;
+		score[1] += h.score_right;
+		legal |= (h.move_left << 3) | (h.move_right << 1);
+		const lookup& v = lookup::find(flip.row(i));
+		after[0] |= spread_row(v.left, i);
+		after[2] |= spread_row(v.right, i);
+		score[0] += v.score_left;
+		score[2] += v.score_right;
+		legal |= (v.move_left << 0) | (v.move_right << 2);
+	}
+	moves m;
+	for (unsigned op = 0; op < 4; op++) {
+		m.after[op] = board(after[op], attr);
+		if (op % 2 == 0) m.after[op].transpose();
+		m.after[op].last_act = op;
+		m.after[op].round = round + 1;
+		m.score[op] = (legal & (1u << op)) ? score[op] : -1;
+	}
+	m.legal = legal;
+	return m;
+}
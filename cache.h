@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+
+/**
+ * lossy transposition table for caching evaluations and search results
+ *
+ * the table holds a power of two of 64-byte buckets within the given byte budget,
+ * each bucket (one cache line) holds 4 entries of (key, value, depth, best move),
+ * a new entry replaces the same key, a stale entry, or the shallowest entry of its bucket
+ *
+ * clear() invalidates all entries lazily by bumping the generation
+ */
+class cache {
+public:
+	struct entry {
+		uint64_t key;
+		float value;
+		uint8_t depth;
+		uint8_t move;
+		uint16_t generation;
+	};
+	struct alignas(64) bucket {
+		entry slot[4];
+	};
+
+public:
+	cache(size_t bytes = 0) : table(nullptr, std::free), mask(0), generation(1), lookups(0), hits(0), stores(0) {
+		size_t num = bytes / sizeof(bucket);
+		while (num & (num - 1)) num &= num - 1; // round down to a power of two
+		if (num == 0) return;
+		void* mem = nullptr;
+		if (posix_memalign(&mem, sizeof(bucket), num * sizeof(bucket)) != 0) return;
+		std::memset(mem, 0, num * sizeof(bucket));
+		table.reset(static_cast<bucket*>(mem));
+		mask = num - 1;
+	}
+	/**
+	 * a copy (e.g., for another thread) starts empty with the same byte budget
+	 */
+	cache(const cache& c) : cache(c.bytes()) {}
+	cache& operator =(const cache& c) = delete;
+
+	bool enabled() const { return table != nullptr; }
+	size_t bytes() const { return enabled() ? (mask + 1) * sizeof(bucket) : 0; }
+
+	/**
+	 * find the entry of a key searched at least the given depth, or nullptr if not found (or disabled)
+	 */
+	const entry* find(uint64_t key, unsigned depth = 0) {
+		if (!enabled()) return nullptr;
+		lookups++;
+		bucket& b = table.get()[key & mask];
+		for (entry& e : b.slot) {
+			if (e.key == key && e.generation == generation && e.depth >= depth) {
+				hits++;
+				return &e;
+			}
+		}
+		return nullptr;
+	}
+
+	void store(uint64_t key, float value, unsigned depth = 0, unsigned move = -1u) {
+		if (!enabled()) return;
+		stores++;
+		bucket& b = table.get()[key & mask];
+		entry* slot = &b.slot[0];
+		for (entry& e : b.slot) {
+			if (e.key == key || e.generation != generation) { slot = &e; break; }
+			if (e.depth < slot->depth) slot = &e;
+		}
+		slot->key = key;
+		slot->value = value;
+		slot->depth = depth;
+		slot->move = move;
+		slot->generation = generation;
+	}
+
+	void clear() {
+		if (++generation == 0) { // wrapped, stale entries may look fresh again
+			std::memset(table.get(), 0, bytes());
+			generation = 1;
+		}
+	}
+
+	double hit_rate() const { return lookups ? hits * 100.0 / lookups : 0; }
+
+	friend std::ostream& operator <<(std::ostream& out, const cache& c) {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "cache = " << (c.bytes() >> 20) << "MB, ";
+		out << "lookups = " << c.lookups << ", hits = " << c.hits;
+		out << " (" << std::fixed << std::setprecision(1) << c.hit_rate() << "%), ";
+		out << "stores = " << c.stores;
+		out.copyfmt(ff);
+		return out;
+	}
+
+public:
+	/**
+	 * mix a packed board into a hash key, by the finalizer of MurmurHash3 (fmix64),
+	 * so that every bit of the board affects the low bits, which index the buckets
+	 */
+	static uint64_t hash(uint64_t x) {
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdull;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ull;
+		return x ^ (x >> 33);
+	}
+	/**
+	 * mix a packed board and its tags (e.g., the bag and the last slide) into a hash key,
+	 * the tags are mixed into the hash of the board, so they never overlay the cells of the board
+	 */
+	static uint64_t hash(uint64_t x, uint64_t tags) {
+		return hash(hash(x) ^ (tags * 0x9e3779b97f4a7c15ull));
+	}
+
+private:
+	std::unique_ptr<bucket, void(*)(void*)> table;
+	size_t mask;
+	uint16_t generation;
+	size_t lookups;
+	size_t hits;
+	size_t stores;
+};
@@ -9,13 +9,14 @@
 #include "board.h"
 #include "action.h"
 #include "agent.h"
+#include "timer.h"
 
 class statistic;
 
 class episode {
 friend class statistic;
 public:
-	episode() : ep_state(initial_state()), ep_score(0), ep_time(0) { ep_moves.reserve(10000); }
+	episode() : ep_state(initial_state()), ep_score(0), ep_time(0), ep_ticks(), ep_timer(nullptr) {}
 
 public:
 	board& state() { return ep_state; }
@@ -24,21 +25,49 @@ public:
 
 	void open_episode(const std::string& tag) {
 		ep_open = { tag, millisec() };
+		ep_moves.reserve(4096);	// no-op for a reused episode
 	}
 	void close_episode(const std::string& tag) {
 		ep_close = { tag, millisec() };
 	}
+	/**
+	 * start over as a new episode, the storage of the moves is kept for reuse
+	 */
+	void clear() {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_moves.clear();
+		ep_time = 0;
+		ep_ticks[0] = ep_ticks[1] = 0;
+		ep_open = {};
+		ep_close = {};
+	}
+
+	/**
+	 * (add) the time of a move is taken by the timer clock (see timer.h) from take_turns() until it is applied,
+	 * it is tallied per agent in ticks, and saved with the move in milliseconds
+	 */
 	bool apply_action(action move) {
+		timer::tick decided = timer::now();
+		bool slide = (move.type() == action::slide::type);
+		if (ep_timer) ep_timer->record(slide ? timer::decide : timer::place, decided - ep_time);
 		board::reward reward = move.apply(state());
 		if (reward == -1) return false;
-		ep_moves.emplace_back(move, reward, millisec() - ep_time);
+		timer::tick applied = timer::now();
+		if (ep_timer) ep_timer->record(timer::apply, applied - decided);
+		ep_ticks[slide] += applied - ep_time;
+		ep_moves.emplace_back(move, reward, time_t(timer::nanos(applied - ep_time) * 1e-6));
 		ep_score += reward;
 		return true;
 	}
+	/**
+	 * record the phases of the following moves into the timer, or stop recording if nullptr
+	 */
+	void profile(timer* t) { ep_timer = t; }
 	// add test
 	// init 9 step is for evil. in 2048 player odd, but in threes even
 	agent& take_turns(agent& play, agent& evil) {
-		ep_time = millisec();
+		ep_time = timer::now();
 		// return (std::max(step() + 1, size_t(2)) % 2) ? play : evil;
 		return (std::max(step() + 1, size_t(9)) % 2) ? evil : play;
 	}
@@ -72,6 +101,18 @@ public:
 		}
 		return time;
 	}
+	/**
+	 * the time in milliseconds as time(), but of the exact ticks of the moves played in this process,
+	 * an episode loaded from a file falls back to the milliseconds of its moves
+	 */
+	double duration(unsigned who = -1u) const {
+		timer::tick ticks = 0;
+		switch (who) {
+		case action::slide::type: ticks = ep_ticks[1]; break;
+		case action::place::type: ticks = ep_ticks[0]; break;
+		}
+		return ticks ? timer::nanos(ticks) * 1e-6 : time(who);
+	}
 
 	std::vector<action> actions(unsigned who = -1u) const {
 		std::vector<action> res;
@@ -114,35 +155,123 @@ public:
 		return in;
 	}
 
+	/**
+	 * the binary form of an episode in the episode log (see statistic::write), integers are varints
+	 *   the open tag and time, the close tag and time, the number of moves,
+	 *   then each move as its 1-byte code (see move::encode) with flags, and its reward and time if they are not 0
+	 * return the number of bytes written
+	 */
+	size_t write(std::streambuf& out) const {
+		size_t len = ep_open.write(out) + ep_close.write(out);
+		len += put_varint(out, ep_moves.size());
+		for (const move& mv : ep_moves) {
+			out.sputc(mv.code | (mv.reward ? move::has_reward : 0) | (mv.time ? move::has_time : 0));
+			len += 1;
+			if (mv.reward) len += put_varint(out, uint32_t(mv.reward));
+			if (mv.time) len += put_varint(out, mv.time);
+		}
+		return len;
+	}
+	/**
+	 * read an episode written by write(), and replay its moves to rebuild the state and the score
+	 * return false if the input is broken
+	 */
+	bool read(std::streambuf& in) {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_ticks[0] = ep_ticks[1] = 0;
+		if (!ep_open.read(in) || !ep_close.read(in)) return false;
+		uint64_t size = 0;
+		if (!get_varint(in, size)) return false;
+		ep_moves.clear();
+		ep_moves.reserve(std::min<uint64_t>(size, 4096));	// the count may be broken, the moves run out at the end of the input
+		for (uint64_t i = 0, reward, time; i < size; i++) {
+			int code = in.sbumpc();
+			reward = time = 0;
+			if (code == EOF) return false;
+			if ((code & move::has_reward) && !get_varint(in, reward)) return false;
+			if ((code & move::has_time) && !get_varint(in, time)) return false;
+			unsigned c = code & 0x3f;
+			if (c >= 52) return false;	// no such slide, e.g., move::unknown
+			ep_moves.emplace_back(move::decode(c), board::reward(reward), time_t(time));
+			ep_score += (c >= 48) ? ep_state.slide(c - 48) : ep_state.place(c & 0x0f, (c >> 4) + 1);	// replay by the code directly
+		}
+		return true;
+	}
+
+	static size_t put_varint(std::streambuf& out, uint64_t v) {
+		size_t len = 1;
+		for (; v >= 0x80; v >>= 7, len++) out.sputc(char(v | 0x80));
+		out.sputc(char(v));
+		return len;
+	}
+	static bool get_varint(std::streambuf& in, uint64_t& v) {
+		v = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			int c = in.sbumpc();
+			if (c == EOF) return false;
+			v |= uint64_t(c & 0x7f) << shift;
+			if (!(c & 0x80)) return true;
+		}
+		return false;
+	}
+
 protected:
 
+	/**
+	 * a move packed into 8 bytes: the code of the action (see encode), the reward in 24 bits,
+	 * and the time in milliseconds
+	 */
 	struct move {
-		action code;
-		board::reward reward;
-		time_t time;
-		move(action code = {}, board::reward reward = 0, time_t time = 0) : code(code), reward(reward), time(time) {}
+		uint32_t code : 8;
+		uint32_t reward : 24;
+		uint32_t time;
+		move(action code = {}, board::reward reward = 0, time_t time = 0) : code(encode(code)), reward(reward), time(time) {}
+
+		operator action() const { return decode(code); }
+
+		/**
+		 * the 6-bit code of an action
+		 *   0-47  : place, (tile - 1) * 16 + position for the tiles 1-3
+		 *   48-51 : slide, 48 + opcode
+		 *   63    : any other action
+		 * in the episode log, the upper 2 bits are the flags of whether the reward (0x40) and the time (0x80) follow
+		 */
+		enum { has_reward = 0x40, has_time = 0x80, unknown = 63 };
+		static uint8_t encode(action a) {
+			if (a.type() == action::slide::type) return 48 + (a.event() & 0b11);
+			unsigned tile = action::place(a).tile();
+			if (a.type() == action::place::type && tile >= 1 && tile <= 3) return (tile - 1) * 16 + action::place(a).position();
+			return unknown;
+		}
+		static action decode(uint8_t c) {
+			if (c == unknown) return action();
+			if (c >= 48) return action::slide(c - 48);
+			return action::place(c & 0x0f, (c >> 4) + 1);
+		}
 
-		operator action() const { return code; }
 		friend std::ostream& operator <<(std::ostream& out, const move& m) {
-			out << m.code;
+			out << action(m);
 			if (m.reward) out << '[' << std::dec << m.reward << ']';
 			if (m.time) out << '(' << std::dec << m.time << ')';
 			return out;
 		}
 		friend std::istream& operator >>(std::istream& in, move& m) {
-			in >> m.code;
-			m.reward = 0;
-			m.time = 0;
+			action code;
+			board::reward reward = 0;
+			time_t time = 0;
+			in >> code;
 			if (in.peek() == '[') {
 				in.ignore(1);
-				in >> std::dec >> m.reward;
+				in >> std::dec >> reward;
 				in.ignore(1);
 			}
 			if (in.peek() == '(') {
 				in.ignore(1);
-				in >> std::dec >> m.time;
+				in >> std::dec >> time;
 				in.ignore(1);
 			}
+			m = move(code, reward, time);
 			return in;
 		}
 	};
@@ -158,6 +287,20 @@ protected:
 		friend std::istream& operator >>(std::istream& in, meta& m) {
 			return std::getline(in, m.tag, '@') >> std::dec >> m.when;
 		}
+
+		size_t write(std::streambuf& out) const {
+			size_t len = put_varint(out, tag.size());
+			len += out.sputn(tag.data(), tag.size());
+			return len + put_varint(out, when);
+		}
+		bool read(std::streambuf& in) {
+			uint64_t size = 0, time = 0;
+			if (!get_varint(in, size)) return false;
+			tag.resize(size);
+			if (in.sgetn(&tag[0], size) != std::streamsize(size) || !get_varint(in, time)) return false;
+			when = time;
+			return true;
+		}
 	};
 
 	static board initial_state() {
@@ -172,7 +315,9 @@ private:
 	board ep_state;
 	board::reward ep_score;
 	std::vector<move> ep_moves;
-	time_t ep_time;
+	timer::tick ep_time;
+	timer::tick ep_ticks[2];	// the ticks of the moves of the environment (0) and the player (1)
+	timer* ep_timer;
 
 	meta ep_open;
 	meta ep_close;
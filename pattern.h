@@ -0,0 +1,137 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include "board.h"
+
+/**
+ * n-tuple pattern for the weight tables
+ *
+ * a pattern is a list of cells (1-d form), together with its isomorphisms,
+ * i.e., the same cells under the 8 rotations and reflections of the board,
+ * and all isomorphisms share one weight table of radix^n entries
+ *
+ * the index of a tuple takes the first cell as the most significant digit,
+ * tiles beyond the radix are clamped to the largest digit
+ */
+class pattern {
+public:
+	pattern(const std::vector<int>& cells, size_t iso = 8, unsigned radix = 15) : length(cells.size()), count(0), base(radix) {
+		for (size_t n = length, scale = 1; n-- > 0; scale *= radix)
+			for (unsigned t = 0; t < 16; t++) digit[n][t] = std::min(t, radix - 1) * scale;
+		board origin;
+		for (int i = 0; i < 16; i++) origin.set(i, i);
+		for (size_t n = 0; n < iso && n < 8; n++, count++) {
+			board b = origin;
+			if (n >= 4) b.reflect_horizontal();
+			b.rotate(n % 4);
+			for (size_t k = 0; k < length; k++)
+				for (int j = 0; j < 16; j++)
+					if (int(b(j)) == cells[k]) iso_cells[n][k] = j;
+		}
+	}
+
+public:
+	size_t size() const {
+		size_t len = 1;
+		for (size_t i = 0; i < length; i++) len *= base;
+		return len;
+	}
+	unsigned radix() const { return base; }
+	size_t isomorphisms() const { return count; }
+	std::vector<int> cells(size_t i = 0) const { return std::vector<int>(iso_cells[i].begin(), iso_cells[i].begin() + length); }
+
+	/**
+	 * the table index of the i-th isomorphism, given the tiles of the board
+	 */
+	uint32_t index(const std::array<uint8_t, 16>& tile, size_t i) const {
+		uint32_t idx = 0;
+		const uint8_t* map = iso_cells[i].data();
+		for (size_t n = 0; n < length; n++) idx += digit[n][tile[map[n]]];
+		return idx;
+	}
+	uint32_t index(const board& b, size_t i) const {
+		std::array<uint8_t, 16> tile;
+		for (int n = 0; n < 16; n++) tile[n] = b(n);
+		return index(tile, i);
+	}
+
+	/**
+	 * whether this is the radix-16 row (0-3) or column (4-7) k in order, no isomorphism
+	 * such a tuple can be fetched from the board directly, see board::row and board::col
+	 */
+	bool is_line(int k) const {
+		if (base != 16 || length != 4 || count != 1) return false;
+		const std::array<uint8_t, 16>& map = iso_cells[0];
+		if (k < 4) return map[0] == k * 4 && map[1] == k * 4 + 1 && map[2] == k * 4 + 2 && map[3] == k * 4 + 3;
+		k -= 4;
+		return map[0] == k && map[1] == k + 4 && map[2] == k + 8 && map[3] == k + 12;
+	}
+
+	/**
+	 * parse a comma-separated list of patterns, each is either
+	 * a list of distinct cells in hexadecimal (e.g., 0123 or 456789), with 8 isomorphisms and radix 15,
+	 * and at most 8 cells for the 32-bit indices, or
+	 * a preset name:
+	 *   legacy : 4 rows and 4 columns, no isomorphism, radix 16 (the original network)
+	 *   row    : 0123 4567
+	 *   axe    : 012345 456789
+	 *   rect   : 012456 45689a
+	 */
+	static std::vector<pattern> parse(const std::string& spec) {
+		std::vector<pattern> tuples;
+		std::stringstream ss(spec);
+		for (std::string token; std::getline(ss, token, ','); ) {
+			if (token == "legacy") {
+				for (int r = 0; r < 4; r++) tuples.emplace_back(std::vector<int>{ r * 4, r * 4 + 1, r * 4 + 2, r * 4 + 3 }, 1, 16);
+				for (int c = 0; c < 4; c++) tuples.emplace_back(std::vector<int>{ c, c + 4, c + 8, c + 12 }, 1, 16);
+			} else if (token == "row") {
+				tuples.emplace_back(cells("0123"));
+				tuples.emplace_back(cells("4567"));
+			} else if (token == "axe") {
+				tuples.emplace_back(cells("012345"));
+				tuples.emplace_back(cells("456789"));
+			} else if (token == "rect") {
+				tuples.emplace_back(cells("012456"));
+				tuples.emplace_back(cells("45689a"));
+			} else if (token.size()) {
+				std::vector<int> list = cells(token);
+				if (list.empty()) {
+					std::cerr << "invalid tuple pattern " << token << ": not 1 to 8 distinct hex cells" << std::endl;
+					std::exit(-1);
+				}
+				tuples.emplace_back(list);
+			}
+		}
+		return tuples;
+	}
+
+	/**
+	 * the cells of a pattern in hexadecimal, or empty if they are not distinct hex digits,
+	 * or too many for radix 15 (15^n > 2^32)
+	 */
+	static std::vector<int> cells(const std::string& hex) {
+		std::vector<int> list;
+		if (hex.size() > 8) return {};
+		for (char c : hex) {
+			const char* digits = "0123456789abcdef";
+			const char* d = std::find(digits, digits + 16, std::tolower(c));
+			int i = d - digits;
+			if (i >= 16 || std::find(list.begin(), list.end(), i) != list.end()) return {};
+			list.push_back(i);
+		}
+		return list;
+	}
+
+private:
+	std::array<std::array<uint8_t, 16>, 8> iso_cells;
+	std::array<std::array<uint32_t, 16>, 16> digit;	// the index contributed by tile t at the n-th cell
+	size_t length;
+	size_t count;
+	unsigned base;
+};
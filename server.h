@@ -0,0 +1,282 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "timer.h"
+
+/**
+ * a long-lived player answering the queries of boards by a line protocol,
+ * over stdin/stdout (see serve) or the connections of a Unix domain socket (see listen)
+ *
+ *   request  : a board, either as the actions which lead to it from the empty board in the text notation
+ *              of the episodes (e.g., "B2537183A102C34231#L[9]B3", a prefix of an episode, where the rewards "[R]" and the times "(T)" are skipped),
+ *              or as "0x" and the 16 hex digits of board::raw(), which assumes a full bag of tiles for search=N
+ *   response : the best slide and its evaluation (reward + value of the afterstate), e.g., "#L 1234.56",
+ *              or "?? 0" if no slide is legal, or "error" if the request is not a board
+ *   "stats"  : the count and the latencies of the requests so far, the average and the percentiles in nanoseconds
+ *
+ * the requests of a connection can be pipelined, they are answered in order
+ * a pool of workers, each with its own copy of the player sharing the weight tables, takes the pending requests
+ * of all connections in batches, and evaluates all their afterstates together (see learning_agent::state_values)
+ * with search=N, each request is searched on its own instead (see learning_player::take_action),
+ * with the bag of the environment rebuilt from the placements of the request
+ *
+ * the latency of a request is from the time it is read until its response is about to be written
+ */
+class server {
+public:
+	server(const learning_player& play, size_t threads = 1, size_t batch = 16) : batch(std::max(batch, size_t(1))), stopping(false) {
+		for (size_t id = 0; id < std::max(threads, size_t(1)); id++)
+			workers.emplace_back([this, &play]() { work(play); });
+	}
+	~server() {
+		{
+			std::lock_guard<std::mutex> lock(queue);
+			stopping = true;
+		}
+		ready.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	/**
+	 * answer the requests read from one file descriptor to another, return at the end of the input
+	 * after all its requests are answered
+	 */
+	void serve(int in, int out) {
+		connection conn(out);
+		std::string text;
+		char chunk[4096];
+		for (ssize_t n; (n = ::read(in, chunk, sizeof(chunk))) > 0 || (n < 0 && errno == EINTR); ) {
+			if (n < 0) continue;
+			text.append(chunk, n);
+			size_t begin = 0;
+			for (size_t end; (end = text.find('\n', begin)) != std::string::npos; begin = end + 1)
+				submit(conn, text.substr(begin, end - begin));
+			text.erase(0, begin);
+		}
+		submit(conn, text);
+		std::unique_lock<std::mutex> lock(conn.lock);
+		conn.done.wait(lock, [&]() { return conn.written == conn.submitted; });
+	}
+
+	/**
+	 * accept the connections of a Unix domain socket at the path, each served on a thread of its own, never return
+	 */
+	void listen(const std::string& path) {
+		sockaddr_un addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path)) {
+			std::cerr << "socket path too long: " << path << std::endl;
+			std::exit(-1);
+		}
+		std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+		::unlink(path.c_str());
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+			std::cerr << "cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+			std::exit(-1);
+		}
+		std::signal(SIGPIPE, SIG_IGN); // a client may leave before its responses are written
+		while (true) {
+			int client = ::accept(fd, nullptr, nullptr);
+			if (client < 0) continue;
+			std::thread([this, client]() {
+				serve(client, client);
+				::close(client);
+			}).detach();
+		}
+	}
+
+	/**
+	 * the latencies of the requests answered so far, as the request phase
+	 */
+	timer latency() const {
+		std::lock_guard<std::mutex> lock(stats);
+		return clock;
+	}
+
+	/**
+	 * parse a board from its actions from the empty board, or from "0x" and its raw hex digits,
+	 * and the tiles remaining in the bag (bit t for tile t) after the placements, or a full bag for "0x"
+	 * return false if the text is not a board
+	 */
+	static bool parse(const std::string& text, board& b, unsigned& bag) {
+		bag = tile_bag::full;
+		if (text.size() == 18 && text.compare(0, 2, "0x") == 0 && text.find_first_not_of("0123456789abcdefABCDEF", 2) == std::string::npos) {
+			b = board(std::stoull(text.substr(2), nullptr, 16));
+			return true;
+		}
+		b = board();
+		std::istringstream in(text);
+		for (in >> std::ws; in.peek() != EOF; in >> std::ws) {
+			action a;
+			in >> a;
+			if (a.apply(b) == -1) return false;
+			if (a.type() == action::place::type) bag = tile_bag::draw(bag, action::place(a).tile());
+			if (in.peek() == '[') in.ignore(text.size(), ']');
+			if (in.peek() == '(') in.ignore(text.size(), ')');
+		}
+		return true;
+	}
+
+protected:
+	/**
+	 * a connection writes the responses in the order of its requests, as they are answered
+	 */
+	struct connection {
+		int out;
+		std::mutex lock;
+		std::condition_variable done;
+		uint64_t submitted;
+		uint64_t written;
+		std::map<uint64_t, std::pair<timer::tick, std::string>> answered; // not yet written, by the order of the requests
+		connection(int out) : out(out), submitted(0), written(0) {}
+	};
+
+	struct request {
+		enum kind { query, stats, invalid };
+		board state;
+		unsigned bag;
+		kind type;
+		connection* conn;
+		uint64_t seq;
+		timer::tick start;
+	};
+
+	void submit(connection& conn, std::string line) {
+		line.erase(0, line.find_first_not_of(" \t\r"));
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if (line.empty()) return;
+		request req = { board(), 0, request::query, &conn, 0, timer::now() };
+		if (line == "stats") req.type = request::stats;
+		else if (!parse(line, req.state, req.bag)) req.type = request::invalid;
+		{
+			std::lock_guard<std::mutex> lock(conn.lock);
+			req.seq = conn.submitted++;
+		}
+		{
+			std::lock_guard<std::mutex> lock(queue);
+			pending.push_back(req);
+		}
+		ready.notify_one();
+	}
+
+	/**
+	 * take the pending requests in batches until the server stops
+	 */
+	void work(const learning_player& proto) {
+		learning_player play(proto);
+		std::vector<request> jobs;
+		std::vector<board::moves> moves;
+		std::vector<board> after;
+		std::vector<float> values;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(queue);
+				ready.wait(lock, [&]() { return stopping || pending.size(); });
+				if (pending.empty()) return;
+				size_t n = std::min(batch, pending.size());
+				jobs.assign(pending.begin(), pending.begin() + n);
+				pending.erase(pending.begin(), pending.begin() + n);
+			}
+			moves.resize(jobs.size());
+			after.resize(jobs.size() * 4);
+			values.resize(jobs.size() * 4);
+			for (size_t i = 0; i < jobs.size(); i++) {
+				moves[i] = jobs[i].state.expand();
+				std::copy(moves[i].after, moves[i].after + 4, after.begin() + i * 4);
+			}
+			if (play.search_depth() == 1) play.state_values(after.data(), after.size(), values.data());
+
+			for (size_t i = 0; i < jobs.size(); i++) {
+				std::stringstream text;
+				if (jobs[i].type == request::query) {
+					int best_op = -1;
+					float best_eval = 0;
+					if (play.search_depth() == 1) {
+						// the same choice as learning_player::take_action
+						for (int op = 0; op < 4; op++) {
+							if (!(moves[i].legal & (1u << op))) continue;
+							float eval = moves[i].score[op] + values[i * 4 + op];
+							if (best_op == -1 || best_eval <= eval) best_op = op, best_eval = eval;
+						}
+					} else {
+						play.open_episode();
+						play.assume_bag(jobs[i].bag);
+						action best = play.take_action(jobs[i].state);
+						if (best.type() == action::slide::type) {
+							best_op = best.event();
+							best_eval = moves[i].score[best_op] + play.state_value(moves[i].after[best_op]);
+						}
+					}
+					text << (best_op != -1 ? action::slide(best_op) : action()) << ' ' << best_eval;
+				} else if (jobs[i].type == request::stats) {
+					timer t = latency();
+					text << std::fixed << std::setprecision(0) << "count=" << t.count(timer::request);
+					if (t.count(timer::request)) {
+						text << " avg=" << (t.total(timer::request) / t.count(timer::request));
+						text << " p50=" << t.percentile(timer::request, 0.5);
+						text << " p90=" << t.percentile(timer::request, 0.9);
+						text << " p99=" << t.percentile(timer::request, 0.99);
+					}
+				} else {
+					text << "error";
+				}
+				answer(jobs[i], text.str());
+			}
+		}
+	}
+
+	/**
+	 * record the latencies of the responses of a connection which are next in order, and write them
+	 */
+	void answer(const request& req, const std::string& text) {
+		connection& conn = *req.conn;
+		std::lock_guard<std::mutex> lock(conn.lock);
+		conn.answered[req.seq] = { req.start, text + '\n' };
+		for (auto it = conn.answered.begin(); it != conn.answered.end() && it->first == conn.written; it = conn.answered.erase(it)) {
+			{
+				std::lock_guard<std::mutex> guard(stats);
+				clock.record(timer::request, timer::now() - it->second.first);
+			}
+			const std::string& line = it->second.second;
+			for (size_t sent = 0; sent < line.size(); ) {
+				ssize_t n = ::write(conn.out, line.data() + sent, line.size() - sent);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) break; // the client is gone, the rest is dropped
+				sent += n;
+			}
+			conn.written++;
+		}
+		conn.done.notify_all();
+	}
+
+private:
+	size_t batch;
+	std::vector<std::thread> workers;
+	std::mutex queue;
+	std::condition_variable ready;
+	std::deque<request> pending;
+	bool stopping;
+
+	mutable std::mutex stats;
+	timer clock;
+};
@@ -3,8 +3,14 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <mutex>
+#include <vector>
+#include <string>
 
 #include <cmath>
+#include <cstring>
+#include <numeric>
+#include <iomanip>
 
 #include "board.h"
 #include "action.h"
@@ -24,7 +30,12 @@ public:
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0),
+		  pending(0),
+		  first(0),
+		  sharded(false),
+		  sink(nullptr),
+		  sink_binary(false) {}
 
 public:
 	/**
@@ -57,32 +68,62 @@ public:
 		return (input<5) ? input : static_cast<int>(log2(input/6)+4);
 	}
 
-	void show(bool tstat = true) const {
-		size_t blk = std::min(data.size(), block);
-		size_t stat[64] = { 0 };
-		size_t sop = 0, pop = 0, eop = 0;
-		time_t sdu = 0, pdu = 0, edu = 0;
-		board::reward sum = 0, max = 0;
-		auto it = data.end();
-		for (size_t i = 0; i < blk; i++) {
-			auto& ep = *(--it);
+	/**
+	 * running aggregates of some episodes, which is all that show() needs
+	 */
+	struct aggregate {
+		size_t games;
+		uint64_t sum;
+		board::reward max;
+		size_t stat[64];
+		size_t sop, pop, eop;
+		double sdu, pdu, edu;	// in milliseconds, see episode::duration
+
+		aggregate() { std::memset(this, 0, sizeof(*this)); }
+		void add(const episode& ep) {
+			games++;
 			sum += ep.score();
 			max = std::max(ep.score(), max);
 
 			// super simple stat , {0,1,2,3} may be wrong
 			//int test_num = (*std::max_element(&(ep.state()(0)), &(ep.state()(16))));
-			//if(i==0) std::cout << "-----------------------start-------------------------------\n";
 			//std::cout << test_num << " " << dec(test_num,false) << std::endl;
-			//if(i==blk-1) std::cout << "\n------------------------end--------------------------------\n";
 
-			stat[dec(*std::max_element(&(ep.state()(0)), &(ep.state()(16))))]++;
+			board::cell top = 0;
+			for (int t = 0; t < 16; t++) top = std::max(top, ep.state()(t));
+			stat[top]++;
 			sop += ep.step();
 			pop += ep.step(action::slide::type);
 			eop += ep.step(action::place::type);
-			sdu += ep.time();
-			pdu += ep.time(action::slide::type);
-			edu += ep.time(action::place::type);
+			sdu += ep.duration();
+			pdu += ep.duration(action::slide::type);
+			edu += ep.duration(action::place::type);
 		}
+		void merge(const aggregate& agg) {
+			games += agg.games;
+			sum += agg.sum;
+			max = std::max(agg.max, max);
+			for (int t = 0; t < 64; t++) stat[t] += agg.stat[t];
+			sop += agg.sop, pop += agg.pop, eop += agg.eop;
+			sdu += agg.sdu, pdu += agg.pdu, edu += agg.edu;
+		}
+	};
+
+	void show(bool tstat = true) const {
+		if (sink) return show(recent, tstat);
+		aggregate blk;
+		auto it = data.end();
+		for (size_t i = 0; i < std::min(data.size(), block); i++) blk.add(*(--it));
+		show(blk, tstat);
+	}
+
+	void show(const aggregate& agg, bool tstat = true) const {
+		size_t blk = agg.games;
+		const size_t* stat = agg.stat;
+		size_t sop = agg.sop, pop = agg.pop, eop = agg.eop;
+		double sdu = agg.sdu, pdu = agg.pdu, edu = agg.edu;
+		uint64_t sum = agg.sum;
+		board::reward max = agg.max;
 		std::ios ff(nullptr);
 		ff.copyfmt(std::cout);
 		std::cout << std::fixed << std::setprecision(0);
@@ -98,7 +139,7 @@ public:
 		if (!tstat) return;
 		for (size_t t = 0, c = 0; c < blk; c += stat[t++]) {
 			if (stat[t] == 0) continue;
-			unsigned accu = std::accumulate(std::begin(stat) + t, std::end(stat), 0);
+			unsigned accu = std::accumulate(stat + t, stat + 64, 0);
 			// std::cout << "\t" << ((1 << t) & -2u); // type
 			// super simple stat , {1,2} may be wrong
 			std::cout << "\t" << dec(t,true); // type
@@ -110,25 +151,135 @@ public:
 	}
 
 	void summary() const {
+		if (sink) return show(overall);
 		auto block_temp = block;
 		const_cast<statistic&>(*this).block = data.size();
 		show();
 		const_cast<statistic&>(*this).block = block_temp;
 	}
 
+	size_t size() const {
+		return count;
+	}
+
 	bool is_finished() const {
 		return count >= total;
 	}
 
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
-		data.emplace_back();
+		count++;
+		if (!sink && data.size() >= limit) spare.splice(spare.end(), data, data.begin());
+		reuse();
 		data.back().open_episode(flag);
 	}
 
 	void close_episode(const std::string& flag = "") {
 		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		if (sink) {
+			record(data.back());
+			spare.splice(spare.end(), data, std::prev(data.end()));
+		} else if (sharded) {
+			recent.add(data.back());
+		}
+		if ((first + count) % block == 0) next_block();
+	}
+
+	/**
+	 * thread-safe interface for parallel self-play
+	 * reserve() claims one of the remaining games, or returns false if all games have been claimed
+	 * commit() records an episode which was played and closed by the claiming thread,
+	 * the episode is swapped with a dropped one (if any), clear() it to reuse its storage
+	 */
+	bool reserve() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (count + pending >= total) return false;
+		pending++;
+		return true;
+	}
+
+	void commit(episode&& ep) {
+		std::lock_guard<std::mutex> lock(mutex);
+		pending--;
+		count++;
+		if (sink) {
+			record(ep);
+		} else {
+			if (data.size() >= limit) spare.splice(spare.end(), data, data.begin());
+			reuse();
+			std::swap(data.back(), ep);
+		}
+		if (count % block == 0) next_block();
+	}
+
+	/**
+	 * make this a shard of the episodes of stat from the given index (e.g., for a parallel evaluation),
+	 * which keeps the aggregates of its episodes split at the blocks of stat, instead of showing them
+	 */
+	void follow(const statistic& stat, size_t offset) {
+		block = stat.block;
+		first = offset;
+		sharded = true;
+	}
+
+	/**
+	 * append the episodes of a shard (see follow) in order, the shard must start at the current size,
+	 * block statistics are shown from the aggregates of the shard as if the episodes were played here,
+	 * including those already dropped by the shard limit, while only the last 'limit' episodes are kept
+	 * (in the streaming mode, only the episodes kept by the shard are written)
+	 */
+	void merge(statistic& shard) {
+		if (!sink) { // the current block so far, see show()
+			recent = aggregate();
+			auto it = data.end();
+			for (size_t i = 0; i < std::min(data.size(), count % block); i++) recent.add(*(--it));
+		}
+		if (shard.recent.games) shard.next_block();
+		for (const aggregate& agg : shard.blocks) {
+			count += agg.games;
+			recent.merge(agg);
+			overall.merge(agg);
+			if (count % block == 0) {
+				show(recent);
+				recent = aggregate();
+			}
+		}
+		shard.blocks.clear();
+		while (shard.data.size()) {
+			if (sink) {
+				if (sink_binary) shard.data.front().write(*sink->rdbuf());
+				else *sink << shard.data.front() << '\n';
+				spare.splice(spare.end(), shard.data, shard.data.begin());
+			} else {
+				if (data.size() >= limit) spare.splice(spare.end(), data, data.begin());
+				data.splice(data.end(), shard.data, shard.data.begin());
+			}
+		}
+	}
+
+	/**
+	 * streaming mode: append each episode to the output as soon as it is closed,
+	 * in the binary episode log (see write()) or the text format, and keep only the aggregates in memory,
+	 * so that the memory does not grow with the number of games
+	 * the episodes kept so far (e.g., loaded ones) are written first, call close_stream() at the end
+	 */
+	void stream(std::ostream& out, bool binary = false) {
+		sink = &out;
+		sink_binary = binary;
+		if (binary) write_header(*out.rdbuf(), -1);	// the number of episodes is unknown until close_stream()
+		for (size_t i = count - data.size() + 1; data.size(); i++) {
+			record(data.front());
+			spare.splice(spare.end(), data, data.begin());
+			if (i % block == 0) recent = aggregate();
+		}
+	}
+	void close_stream() {
+		if (sink && sink_binary) {
+			put_integer(*sink->rdbuf(), uint64_t(0));	// no index
+			sink->seekp(16);
+			put_integer(*sink->rdbuf(), uint64_t(count));
+		}
+		if (sink) sink->flush();
+		sink = nullptr;
 	}
 
 	episode& at(size_t i) {
@@ -157,6 +308,107 @@ public:
 		return in;
 	}
 
+	/**
+	 * binary episode log, integers are little-endian
+	 *   "TCGEPLOG", uint32 version (1), uint32 reserved, uint64 number of episodes,
+	 *   then the episodes (see episode::write),
+	 *   then the index: uint64 offset of each episode, and finally uint64 offset of the index
+	 * the log is written and read sequentially, the index is for tools which seek the episodes
+	 * a streamed log (see stream()) has no index, i.e., its offset is 0,
+	 * and the number of episodes is -1 if the log was not closed
+	 */
+	void write(std::ostream& out) const {
+		std::streambuf& buf = *out.rdbuf();
+		uint64_t offset = 0, size = data.size();
+		std::vector<uint64_t> index;
+		index.reserve(size);
+		offset += write_header(buf, size);
+		for (const episode& rec : data) {
+			index.push_back(offset);
+			offset += rec.write(buf);
+		}
+		for (uint64_t pos : index) put_integer(buf, pos);
+		put_integer(buf, offset);
+	}
+	/**
+	 * read the episodes of a binary episode log one by one, return false if the log is broken
+	 */
+	bool read(std::istream& in) {
+		std::streambuf& buf = *in.rdbuf();
+		char magic[8];
+		uint32_t version, reserved;
+		uint64_t size;
+		if (buf.sgetn(magic, 8) != 8 || std::string(magic, 8) != std::string(log_magic, 8)) return false;
+		if (!get_integer(buf, version) || !get_integer(buf, reserved) || !get_integer(buf, size) || version != 1) return false;
+		for (uint64_t i = 0; i < size; i++) {
+			if (size == uint64_t(-1) && buf.sgetc() == EOF) break;
+			data.emplace_back();
+			if (!data.back().read(buf)) {
+				data.pop_back();
+				return false;
+			}
+			count++;
+		}
+		total = std::max(total, count);
+		return true;
+	}
+	/**
+	 * whether the input is a binary episode log, the input is not consumed
+	 */
+	static bool is_log(std::istream& in) {
+		char magic[8] = {};
+		std::streampos pos = in.tellg();
+		in.read(magic, 8);
+		in.clear();
+		in.seekg(pos);
+		return std::string(magic, 8) == std::string(log_magic, 8);
+	}
+
+private:
+	static constexpr const char* log_magic = "TCGEPLOG";
+
+	static std::streamsize write_header(std::streambuf& out, uint64_t size) {
+		std::streamsize len = out.sputn(log_magic, 8);
+		len += put_integer(out, uint32_t(1));
+		len += put_integer(out, uint32_t(0));
+		return len + put_integer(out, size);
+	}
+
+	void record(const episode& ep) {
+		if (sink_binary) ep.write(*sink->rdbuf());
+		else *sink << ep << '\n';
+		recent.add(ep);
+		overall.add(ep);
+	}
+
+	/**
+	 * append an empty episode, reusing a dropped one (and its storage of moves) if any
+	 * so that no allocation is needed once the limit is reached (or in the streaming mode)
+	 */
+	void reuse() {
+		if (spare.empty()) {
+			data.emplace_back();
+			return;
+		}
+		data.splice(data.end(), spare, spare.begin());
+		data.back().clear();
+	}
+
+	void next_block() {
+		if (sharded) blocks.push_back(recent);
+		else show();
+		recent = aggregate();
+	}
+
+	template<typename integer>
+	static std::streamsize put_integer(std::streambuf& out, integer v) {
+		return out.sputn(reinterpret_cast<const char*>(&v), sizeof(v));
+	}
+	template<typename integer>
+	static bool get_integer(std::streambuf& in, integer& v) {
+		return in.sgetn(reinterpret_cast<char*>(&v), sizeof(v)) == sizeof(v);
+	}
+
 
 
 private:
@@ -164,5 +416,16 @@ private:
 	size_t block;
 	size_t limit;
 	size_t count;
+	size_t pending;
+	size_t first;	// the index of the first episode of a shard, see follow()
+	bool sharded;
+	std::vector<aggregate> blocks;	// the aggregates of a shard, split at the blocks
 	std::list<episode> data;
+	std::list<episode> spare;	// dropped episodes for reuse
+	std::mutex mutex;
+
+	std::ostream* sink;	// of the streaming mode
+	bool sink_binary;
+	aggregate recent;	// the aggregates of the current block and of all episodes, in the streaming mode
+	aggregate overall;
 };
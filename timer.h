@@ -0,0 +1,150 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * low-overhead timing of the game loop by phases: the player decides, the environment places,
+ * the move is applied, and the player learns at the end of an episode,
+ * or of the requests answered in the server mode (see server.h)
+ *
+ * the clock is the TSC on x86 (about 20ns to read, calibrated against steady_clock at the first use),
+ * or steady_clock elsewhere, both in nanosecond resolution
+ * each phase keeps its count, its total time, and a histogram of the ticks in quarters of octaves
+ *
+ * compile with -DNO_TIMING to switch it off, then the clock always reads 0 and nothing is recorded
+ */
+class timer {
+public:
+	enum phase { decide, place, apply, learn, request, num_phases };
+	typedef uint64_t tick;
+
+	timer() { std::memset(phases, 0, sizeof(phases)); }
+
+	static tick now() {
+#if defined(NO_TIMING)
+		return 0;
+#elif defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+	/**
+	 * convert the ticks of the clock into nanoseconds
+	 */
+	static double nanos(tick t) { return t * period(); }
+
+	static constexpr bool enabled() {
+#if defined(NO_TIMING)
+		return false;
+#else
+		return true;
+#endif
+	}
+
+public:
+	void record(phase p, tick elapsed) {
+#if !defined(NO_TIMING)
+		stat& s = phases[p];
+		s.count++;
+		s.ticks += elapsed;
+		s.bins[bin(elapsed)]++;
+#endif
+	}
+	void merge(const timer& t) {
+		for (int p = 0; p < num_phases; p++) {
+			phases[p].count += t.phases[p].count;
+			phases[p].ticks += t.phases[p].ticks;
+			for (int i = 0; i < num_bins; i++) phases[p].bins[i] += t.phases[p].bins[i];
+		}
+	}
+	uint64_t count(phase p) const { return phases[p].count; }
+	double total(phase p) const { return nanos(phases[p].ticks); }
+
+	/**
+	 * print a line for each phase: the count, the average, the percentiles (the upper bounds of the bins),
+	 * the total time, and the throughput of the phase alone
+	 */
+	friend std::ostream& operator <<(std::ostream& out, const timer& t) {
+		if (!enabled()) return out << "timing is disabled (NO_TIMING)" << std::endl;
+		static const char* name[] = { "decide", "place", "apply", "learn", "request" };
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed << std::setprecision(0);
+		out << "phase\tcount\tavg(ns)\tp50\tp90\tp99\ttotal(ms)\tops" << std::endl;
+		for (int p = 0; p < num_phases; p++) {
+			const stat& s = t.phases[p];
+			if (s.count == 0) continue;
+			double total = nanos(s.ticks);
+			out << name[p] << "\t" << s.count << "\t" << (total / s.count);
+			out << "\t" << t.percentile(phase(p), 0.5);
+			out << "\t" << t.percentile(phase(p), 0.9);
+			out << "\t" << t.percentile(phase(p), 0.99);
+			out << "\t" << (total / 1e6) << "\t" << (s.count * 1e9 / total) << std::endl;
+		}
+		out.copyfmt(ff);
+		return out;
+	}
+
+	/**
+	 * the upper bound (in nanoseconds) of the bin where the given fraction of the samples is reached
+	 */
+	double percentile(phase p, double q) const {
+		const stat& s = phases[p];
+		uint64_t need = uint64_t(s.count * q), seen = 0;
+		for (int i = 0; i < num_bins; i++) {
+			seen += s.bins[i];
+			if (seen > need) return nanos(bound(i));
+		}
+		return nanos(-1ull);
+	}
+
+private:
+	/**
+	 * nanoseconds per tick, the TSC is calibrated by a 2ms busy wait on steady_clock at the first use
+	 */
+	static double period() {
+#if defined(NO_TIMING) || !(defined(__x86_64__) || defined(__i386__))
+		return 1;
+#else
+		static const double ns = []() {
+			typedef std::chrono::steady_clock clock;
+			auto t0 = clock::now();
+			tick c0 = __rdtsc();
+			auto t1 = t0;
+			while (t1 - t0 < std::chrono::milliseconds(2)) t1 = clock::now();
+			tick c1 = __rdtsc();
+			return std::chrono::duration<double, std::nano>(t1 - t0).count() / (c1 - c0);
+		}();
+		return ns;
+#endif
+	}
+
+	/**
+	 * the bins below 4 ticks are exact, and each octave [2^k, 2^(k+1)) above is split into 4 bins
+	 */
+	enum { num_bins = 256 };
+	static unsigned bin(tick t) {
+		if (t < 4) return t;
+		unsigned k = 63 - __builtin_clzll(t);
+		return (k << 2) | ((t >> (k - 2)) & 3);
+	}
+	static tick bound(unsigned i) { // the exclusive upper bound of a bin
+		if (i < 4) return i + 1;
+		return tick(4 + (i & 3) + 1) << ((i >> 2) - 2);
+	}
+
+	struct stat {
+		uint64_t count;
+		tick ticks;
+		uint64_t bins[num_bins];
+	};
+	stat phases[num_phases];
+};
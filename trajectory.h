@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+/**
+ * trajectory of the afterstates in an episode, for training
+ *
+ * each step keeps the reward of reaching the afterstate, and the feature indices of the network (a fixed number per step),
+ * the values are not kept, since the training needs them after the updates of the later steps
+ *
+ * the storage is kept across episodes and only grows (doubles) when a longer episode comes,
+ * so recording an episode needs no allocation after the first few
+ */
+class trajectory {
+public:
+	trajectory(size_t width = 0, size_t capacity = 2048) : width(width), count(0) {
+		rewards.resize(capacity);
+		indices.resize(capacity * width);
+	}
+
+public:
+	void clear() { count = 0; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	/**
+	 * append a step, whose feature indices are to be filled through index(size() - 1)
+	 */
+	void push(float reward) {
+		if (count == rewards.size()) {
+			rewards.resize(rewards.size() * 2);
+			indices.resize(rewards.size() * width);
+		}
+		rewards[count++] = reward;
+	}
+	/**
+	 * drop the first n steps, e.g., those already trained in online learning
+	 */
+	void erase_front(size_t n) {
+		std::copy(rewards.begin() + n, rewards.begin() + count, rewards.begin());
+		std::copy(indices.begin() + n * width, indices.begin() + count * width, indices.begin());
+		count -= n;
+	}
+
+	float reward(size_t i) const { return rewards[i]; }
+	uint32_t* index(size_t i) { return &indices[i * width]; }
+	const uint32_t* index(size_t i) const { return &indices[i * width]; }
+
+private:
+	size_t width;
+	size_t count;
+	std::vector<float> rewards;
+	std::vector<uint32_t> indices;
+};
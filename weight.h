@@ -10,37 +10,229 @@
 #pragma once
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <utility>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
-class weight {
+/**
+ * where the memory of the weight tables comes from, chosen by the options of the agent
+ *   pages=thp  : anonymous memory advised for transparent huge pages (2MB)
+ *   pages=huge : explicit huge pages (MAP_HUGETLB) from the reserved pool, or transparent ones if it runs short
+ *   numa=interleave : the pages are interleaved over all nodes
+ *   numa=replica    : as the default, but each copy of the agent (thread) reads a replica on its own node,
+ *                     for inference only (see weight_agent)
+ * by default, the tables are on the heap, or in the mapped weight file
+ * with huge pages, each table is rounded up to whole 2MB pages
+ */
+struct memory_policy {
+	enum { small, thp, huge } pages;
+	enum { local, interleave, replica } numa;
+
+	memory_policy() : pages(small), numa(local) {}
+	bool custom() const { return pages != small || numa != local; }
+
+	/**
+	 * allocate zero-filled memory of at least the given bytes, on the given node if it is not -1
+	 * the length of the mapping is returned in the bytes, nullptr if failed
+	 */
+	void* allocate(size_t& bytes, int node = -1) const {
+		enum { huge_size = 2 << 20 };
+		size_t len = (pages == small) ? bytes : (bytes + huge_size - 1) / huge_size * huge_size;
+		void* mem = MAP_FAILED;
+		if (pages == huge) {
+			mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (mem == MAP_FAILED) warn(0, "no explicit huge pages for a table, transparent ones are used");
+		}
+		if (mem == MAP_FAILED && pages != small) {
+			// map 2MB more to align the start to a huge page, and unmap the rest
+			char* raw = static_cast<char*>(mmap(nullptr, len + huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+			if (raw == MAP_FAILED) return nullptr;
+			char* head = raw + (huge_size - reinterpret_cast<uintptr_t>(raw) % huge_size) % huge_size;
+			if (head != raw) munmap(raw, head - raw);
+			if (head + len != raw + len + huge_size) munmap(head + len, raw + huge_size - head);
+			mem = head;
+			if (madvise(mem, len, MADV_HUGEPAGE) != 0) warn(1, "transparent huge pages are not available");
+		}
+		if (mem == MAP_FAILED) mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) return nullptr;
+		// set the policy before the pages are touched
+		enum { mpol_preferred = 1, mpol_interleave = 3 };
+		unsigned long nodes = (node >= 0) ? (1ul << node) : ~0ul;
+		int mode = (node >= 0) ? mpol_preferred : mpol_interleave;
+		if ((node >= 0 || numa == interleave) && syscall(SYS_mbind, mem, len, mode, &nodes, sizeof(nodes) * 8, 0) != 0)
+			warn(2, "the NUMA policy is not available");
+		bytes = len;
+		return mem;
+	}
+
+	/**
+	 * the NUMA node of the CPU which the calling thread runs on
+	 */
+	static int current_node() {
+		unsigned cpu = 0, node = 0;
+		return syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? int(node) : 0;
+	}
+
+	static void warn(int id, const char* msg) {
+		static bool warned[3] = {};
+		if (!warned[id]) std::cerr << msg << std::endl;
+		warned[id] = true;
+	}
+};
+
+/**
+ * weight table
+ * (add) the table is shared between copies, so that several agents (threads) can train the same network
+ * (add) the entries are of the given storage type, see quantize() for tables of integers
+ */
+template<typename type>
+class basic_weight {
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	typedef type value_type;
+
+	basic_weight() : value(nullptr), length(0), ratio(1) {}
+	basic_weight(size_t len) : store(new type[len](), std::default_delete<type[]>()), value(store.get()), length(len), ratio(1) {}
+	/**
+	 * a table on external storage (e.g., a mapped file), which is kept alive by the owner
+	 */
+	basic_weight(type* value, size_t len, const std::shared_ptr<void>& owner, float scale = 1)
+		: store(owner, value), value(value), length(len), ratio(scale) {}
+	/**
+	 * a zero-filled table by the memory policy
+	 */
+	basic_weight(size_t len, const memory_policy& mem, int node = -1) : basic_weight() {
+		size_t bytes = sizeof(type) * len;
+		void* raw = mem.allocate(bytes, node);
+		if (!raw) throw std::bad_alloc();
+		store.reset(static_cast<type*>(raw), [bytes](type* p) { munmap(p, bytes); });
+		value = store.get();
+		length = len;
+	}
+	/**
+	 * a copy of the entries into a new table by the memory policy
+	 */
+	basic_weight clone(const memory_policy& mem, int node = -1) const {
+		basic_weight w(length, mem, node);
+		std::copy(value, value + length, w.value);
+		w.ratio = ratio;
+		return w;
+	}
+	basic_weight(basic_weight&& f) = default;
+	basic_weight(const basic_weight& f) = default;
 
-	weight& operator =(const weight& f) = default;
-	float& operator[] (size_t i) { return value[i]; }
-	const float& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	basic_weight& operator =(const basic_weight& f) = default;
+	type& operator[] (size_t i) { return value[i]; }
+	const type& operator[] (size_t i) const { return value[i]; }
+	size_t size() const { return length; }
+
+	/**
+	 * the real value of an entry is (entry * scale), which is 1 except for quantized tables
+	 */
+	float scale() const { return ratio; }
+
+	/**
+	 * lock-free accumulation for training from several threads (Hogwild style)
+	 * concurrent updates of the same entry may be lost, but never torn
+	 */
+	void accumulate(size_t i, type v) {
+		type w;
+		__atomic_load(value + i, &w, __ATOMIC_RELAXED);
+		w += v;
+		__atomic_store(value + i, &w, __ATOMIC_RELAXED);
+	}
+
+	/**
+	 * quantize a float table into this storage type (a signed integer) with a scale of max|w| / max(type)
+	 */
+	static basic_weight quantize(const basic_weight<float>& w) {
+		float peak = 0;
+		for (size_t i = 0; i < w.size(); i++) peak = std::max(peak, std::abs(w[i]));
+		basic_weight q(w.size());
+		q.ratio = peak ? peak / std::numeric_limits<type>::max() : 1;
+		for (size_t i = 0; i < w.size(); i++) q.value[i] = type(std::lround(w[i] / q.ratio));
+		return q;
+	}
 
 public:
-	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+	/**
+	 * map a file into memory privately, i.e., the pages are shared with the page cache (and other processes)
+	 * until they are written, return nullptr if failed
+	 */
+	static std::shared_ptr<char> map(const std::string& path, size_t& len) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return nullptr;
+		struct stat st;
+		void* mem = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			mem = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mem == MAP_FAILED) return nullptr;
+		len = st.st_size;
+		return std::shared_ptr<char>(static_cast<char*>(mem), [len](char* p) { munmap(p, len); });
+	}
+
+	static uint32_t crc32(const void* data, size_t len, uint32_t crc = 0) {
+		static const struct lookup {
+			uint32_t v[256];
+			lookup() {
+				for (uint32_t i = 0; i < 256; i++) {
+					uint32_t c = i;
+					for (int k = 0; k < 8; k++) c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+					v[i] = c;
+				}
+			}
+		} table;
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		crc = ~crc;
+		while (len--) crc = table.v[(crc ^ *(p++)) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+	uint32_t crc32(uint32_t crc = 0) const { return crc32(value, sizeof(type) * length, crc); }
+
+public:
+	friend std::ostream& operator <<(std::ostream& out, const basic_weight& w) {
+		uint64_t size = w.size();
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(float) * size);
+		out.write(reinterpret_cast<const char*>(w.value), sizeof(type) * size);
 		return out;
 	}
-	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
+	friend std::istream& operator >>(std::istream& in, basic_weight& w) {
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(float) * size);
+		w = basic_weight(size);
+		in.read(reinterpret_cast<char*>(w.value), sizeof(type) * size);
 		return in;
 	}
 
 protected:
-	std::vector<float> value;
+	std::shared_ptr<type> store;
+	type* value;
+	size_t length;
+	float ratio;
 };
+
+/**
+ * the accumulators of an entry for temporal coherence learning,
+ * the sum of the TD errors and the sum of their magnitudes, interleaved in one table
+ */
+struct coherence {
+	float error;
+	float magnitude;
+	coherence& operator +=(const coherence& c) { error += c.error; magnitude += c.magnitude; return *this; }
+	/**
+	 * the adaptive ratio of the learning rate, 1 for an entry never updated
+	 */
+	float rate() const { return magnitude != 0 ? std::abs(error) / magnitude : 1; }
+};
+
+typedef basic_weight<float> weight;
+typedef basic_weight<int16_t> qweight;	// quantized weight for inference
+typedef basic_weight<coherence> cweight;	// accumulators for temporal coherence learning